@@ -40,16 +40,29 @@ public:
     glm::vec3 target;
     int maxIterations;
     float threshold; // threshold distance between endEffector and the targetPos
+    // the end effector is effectorOffset along the bone of joint effectorJoint, or the tip of the
+    // last bone when effectorJoint is -1
+    int effectorJoint = -1;
+    float effectorOffset = 0.0f;
 
     IKClass(int maxIter = 30, float thresh = 0.0001f) : maxIterations(maxIter), threshold(thresh) {}
 
+    glm::vec3 endEffectorPosition() const {
+        const IKJoint& joint = effectorJoint >= 0 ? chain.joints[effectorJoint] : chain.joints.back();
+        float offset = effectorJoint >= 0 ? effectorOffset : joint.boneLength;
+        return joint.position + joint.globalRotation * glm::vec3(offset, 0.0, 0.0);
+    }
+
     void applyCCD() {
+        // joints after the effector can't move it
+        int first = chain.joints.size() - 4; // Start at second to last joint
+        if (effectorJoint >= 0 && effectorJoint < first)
+            first = effectorJoint;
         for (int iter = 0; iter < maxIterations; ++iter) {
             bool updated = false;
-            for (int i = chain.joints.size() - 4; i >= 0; --i) { // Start at second to last joint
+            for (int i = first; i >= 0; --i) {
                 auto& joint = chain.joints[i];
-                auto& lastJoint = chain.joints.back();
-                glm::vec3 endEffector = lastJoint.position + lastJoint.globalRotation * glm::vec3(lastJoint.boneLength, 0.0, 0.0);
+                glm::vec3 endEffector = endEffectorPosition();
 
                 glm::vec3 toTarget = glm::normalize(target - joint.position);
                 glm::vec3 toEndEffector = glm::normalize(endEffector - joint.position);
@@ -103,7 +116,7 @@ public:
             }
             
             // Check if we are close enough to the target to terminate
-            if (glm::distance(chain.joints.back().position, target) < threshold) {
+            if (glm::distance(endEffectorPosition(), target) < threshold) {
                 break; // Exit if we've reached the target within the threshold
             }
 
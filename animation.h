@@ -9,6 +9,7 @@
 #include <functional>
 #include "animdata.h"
 #include "model.h"
+#include "bone_names.h"
 
 struct AssimpNodeData
 {
@@ -16,6 +17,7 @@ struct AssimpNodeData
 	std::string name;
 	int childrenCount;
 	std::vector<AssimpNodeData> children;
+	int boneHandle = BoneNameTable::InvalidHandle; // resolved once at load time
 };
 
 class Animation
@@ -24,10 +26,26 @@ public:
 	Animation() = default;
 
 	Animation(const std::string& animationPath, Model* model)
+	{
+		Load(animationPath, model);
+	}
+
+	// reads the first animation of the file; false (with an error printed) if the file can't be
+	// read or has no animation, in which case the Animation is left empty
+	bool Load(const std::string& animationPath, Model* model)
 	{
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
-		assert(scene && scene->mRootNode);
+		if (!scene || !scene->mRootNode)
+		{
+			std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+			return false;
+		}
+		if (scene->mNumAnimations == 0)
+		{
+			std::cout << "ERROR::ANIMATION:: no animation in " << animationPath << std::endl;
+			return false;
+		}
 		auto animation = scene->mAnimations[0];
 		m_Duration = animation->mDuration;
 		m_TicksPerSecond = animation->mTicksPerSecond;
@@ -35,6 +53,8 @@ public:
 		globalTransformation = globalTransformation.Inverse();
 		ReadHierarchyData(m_RootNode, scene->mRootNode);
 		ReadMissingBones(animation, *model);
+		ResolveBoneHandles(m_RootNode);
+		return true;
 	}
 
 	~Animation()
@@ -43,16 +63,23 @@ public:
 
 	Bone* FindBone(const std::string& name)
 	{
-		auto iter = std::find_if(m_Bones.begin(), m_Bones.end(),
-			[&](const Bone& Bone)
-			{
-				return Bone.GetBoneName() == name;
-			}
-		);
-		if (iter == m_Bones.end()) return nullptr;
-		else return &(*iter);
+		int handle = m_BoneNames.Find(name);
+		if (handle == BoneNameTable::InvalidHandle) return nullptr;
+		else return GetBone(handle);
 	}
 
+	// animated bone for a handle, or nullptr if the bone has no channel in this animation
+	Bone* GetBone(int handle)
+	{
+		int index = m_BoneIndexByHandle[handle];
+		if (index < 0) return nullptr;
+		else return &m_Bones[index];
+	}
+
+	inline const glm::mat4& GetBoneOffset(int handle) const { return m_BoneOffsets[handle]; }
+	inline int GetBoneCount() const { return (int)m_BoneOffsets.size(); }
+	inline const BoneNameTable& GetBoneNames() const { return m_BoneNames; }
+
 	void PrintBoneInfo() {
 		std::cout << "Total number of bones loaded: " << m_Bones.size() << std::endl;
 		std::cout << "List of bones: " << std::endl;
@@ -76,6 +103,7 @@ private:
 
 		auto& boneInfoMap = model.GetBoneInfoMap();//getting m_BoneInfoMap from Model class
 		int& boneCount = model.GetBoneCount(); //getting the m_BoneCounter from Model class
+		auto& boneNames = model.GetBoneNames();
 
 		//reading channels(bones engaged in an animation and their keyframes)
 		for (int i = 0; i < size; i++)
@@ -83,16 +111,35 @@ private:
 			auto channel = animation->mChannels[i];
 			std::string boneName = channel->mNodeName.data;
 
-			if (boneInfoMap.find(boneName) == boneInfoMap.end())
+			int handle = boneNames.Find(boneName);
+			if (handle == BoneNameTable::InvalidHandle)
 			{
-				boneInfoMap[boneName].id = boneCount;
+				handle = boneNames.Intern(boneName);
+				assert(handle == boneCount);
+				boneInfoMap[boneName].id = handle;
 				boneCount++;
 			}
-			m_Bones.push_back(Bone(channel->mNodeName.data,
-				boneInfoMap[channel->mNodeName.data].id, channel));
+			m_Bones.push_back(Bone(boneName, handle, channel));
 		}
 
 		m_BoneInfoMap = boneInfoMap;
+		m_BoneNames = boneNames;
+
+		// flatten into handle-indexed arrays for the per-frame path
+		m_BoneOffsets.assign(m_BoneNames.Size(), glm::mat4(1.0f));
+		for (const auto& boneInfo : m_BoneInfoMap)
+			m_BoneOffsets[boneInfo.second.id] = boneInfo.second.offset;
+
+		m_BoneIndexByHandle.assign(m_BoneNames.Size(), -1);
+		for (int i = 0; i < (int)m_Bones.size(); i++)
+			m_BoneIndexByHandle[m_Bones[i].GetBoneID()] = i;
+	}
+
+	void ResolveBoneHandles(AssimpNodeData& node)
+	{
+		node.boneHandle = m_BoneNames.Find(node.name);
+		for (auto& child : node.children)
+			ResolveBoneHandles(child);
 	}
 
 	void ReadHierarchyData(AssimpNodeData& dest, const aiNode* src)
@@ -110,9 +157,12 @@ private:
 			dest.children.push_back(newData);
 		}
 	}
-	float m_Duration;
-	int m_TicksPerSecond;
+	float m_Duration = 0.0f;
+	int m_TicksPerSecond = 0;
 	std::vector<Bone> m_Bones;
 	AssimpNodeData m_RootNode;
 	std::map<std::string, BoneInfo> m_BoneInfoMap;
+	BoneNameTable m_BoneNames;
+	std::vector<glm::mat4> m_BoneOffsets;	// indexed by bone handle
+	std::vector<int> m_BoneIndexByHandle;	// bone handle -> index in m_Bones, -1 if not animated
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+/* Update-rate level of detail for animators */
+
+#include <glm/glm.hpp>
+#include "camera.h"
+
+// projected radius (in pixels) above which a character gets each update interval;
+// anything smaller than quarterRateRadius is updated every 8th frame
+struct AnimationLODSettings
+{
+	float fullRateRadius = 120.0f;
+	float halfRateRadius = 60.0f;
+	float quarterRateRadius = 25.0f;
+};
+
+inline int SelectAnimationUpdateInterval(float projectedRadius, const AnimationLODSettings& settings = AnimationLODSettings())
+{
+	if (projectedRadius >= settings.fullRateRadius)
+		return 1;
+	if (projectedRadius >= settings.halfRateRadius)
+		return 2;
+	if (projectedRadius >= settings.quarterRateRadius)
+		return 4;
+	return 8;
+}
+
+inline int SelectAnimationUpdateInterval(const Camera& camera, const glm::vec3& center, float radius, float viewportHeight,
+	const AnimationLODSettings& settings = AnimationLODSettings())
+{
+	return SelectAnimationUpdateInterval(camera.GetProjectedRadius(center, radius, viewportHeight), settings);
+}
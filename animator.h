@@ -1,81 +1,199 @@
 #pragma once
 #pragma once
 
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <map>
+#include <memory>
 #include <vector>
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include "animation.h"
 #include "bone.h"
+#include "bone_palette.h"
 
 class Animator
 {
 public:
-	Animator(Animation* animation)
+	// with sharedPalette set, each update fills a palette of its own and publishes it when done,
+	// so one other thread can keep reading the last published palette through GetPalette()
+	Animator(Animation* animation, bool sharedPalette = false)
 	{
 		m_CurrentTime = 0.0;
 		m_CurrentAnimation = animation;
 
-		m_FinalBoneMatrices.reserve(100);
+		if (sharedPalette)
+			m_SharedPalette = std::make_unique<SharedPalette>();
 
-		for (int i = 0; i < 100; i++)
-			m_FinalBoneMatrices.push_back(glm::mat4(1.0f));
+		ResizePalette();
 	}
 
 	void UpdateAnimation(float dt)
+	{
+		if (m_SharedPalette)
+		{
+			UpdateAnimation(dt, m_SharedPalette->GetBackBuffer());
+			m_SharedPalette->Publish();
+		}
+		else
+			UpdateAnimation(dt, m_FinalBoneMatrices.data());
+	}
+
+	// same as above, but writes the pose into an external palette that holds at least
+	// one matrix per bone of the current animation (used by CrowdAnimator)
+	void UpdateAnimation(float dt, glm::mat4* palette)
 	{
 		m_DeltaTime = dt;
-		if (m_CurrentAnimation)
+		if (!m_CurrentAnimation)
+			return;
+
+		float ticks = m_CurrentAnimation->GetTicksPerSecond() * dt;
+		m_CurrentTime += ticks;
+		m_CurrentTime = fmod(m_CurrentTime, m_CurrentAnimation->GetDuration());
+
+		if (m_UpdateInterval <= 1)
 		{
-			m_CurrentTime += m_CurrentAnimation->GetTicksPerSecond() * dt;
-			m_CurrentTime = fmod(m_CurrentTime, m_CurrentAnimation->GetDuration());
-			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f));
+			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f), palette, m_CurrentTime);
+			return;
 		}
+
+		// reduced rate: at the start of each interval sample the pose one interval ahead,
+		// then blend towards it from the previous key on every frame in between. Right after
+		// an interval change or PlayAnimation both keys are sampled at once, the second one
+		// where the phase puts the next full evaluation, so the pose never starts from identity.
+		if (!m_KeyPosesValid)
+		{
+			int remaining = m_UpdateInterval - m_FrameInInterval;
+			float keyTime = fmod(m_CurrentTime + ticks * remaining, m_CurrentAnimation->GetDuration());
+			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f), m_KeyPoses[0].data(), m_CurrentTime);
+			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f), m_KeyPoses[1].data(), keyTime);
+			m_SegmentFrame = 0;
+			m_SegmentLength = remaining;
+			m_KeyPosesValid = true;
+		}
+		else if (m_FrameInInterval == 0)
+		{
+			std::swap(m_KeyPoses[0], m_KeyPoses[1]);
+			float keyTime = fmod(m_CurrentTime + ticks * m_UpdateInterval, m_CurrentAnimation->GetDuration());
+			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f), m_KeyPoses[1].data(), keyTime);
+			m_SegmentFrame = 0;
+			m_SegmentLength = m_UpdateInterval;
+		}
+
+		// the palette matrices are lerped component-wise, not decomposed into TRS, so a bone
+		// rotating between the keys shrinks slightly mid-interval; that is invisible at the
+		// on-screen sizes reduced rates are picked for and keeps the in-between frames cheap
+		float blend = (float)m_SegmentFrame / (float)m_SegmentLength;
+		for (size_t i = 0; i < m_KeyPoses[0].size(); i++)
+			palette[i] = m_KeyPoses[0][i] * (1.0f - blend) + m_KeyPoses[1][i] * blend;
+
+		m_SegmentFrame++;
+		m_FrameInInterval = (m_FrameInInterval + 1) % m_UpdateInterval;
+	}
+
+	// runs the full hierarchy evaluation only every interval-th update (1, 2, 4 or 8) and
+	// interpolates the frames in between; phase staggers full updates across instances and
+	// only decides on which frame they happen, the pose is sampled on the next update anyway
+	void SetUpdateInterval(int interval, int phase = 0)
+	{
+		interval = std::max(interval, 1);
+		if (interval == m_UpdateInterval)
+			return;
+
+		m_UpdateInterval = interval;
+		m_FrameInInterval = phase % interval;
+		m_KeyPosesValid = false;
+		ResizeKeyPoses();
 	}
 
+	int GetUpdateInterval() const { return m_UpdateInterval; }
+
 	void PlayAnimation(Animation* pAnimation)
 	{
 		m_CurrentAnimation = pAnimation;
 		m_CurrentTime = 0.0f;
+		m_KeyPosesValid = false;
+		ResizePalette();
 	}
 
 	void CalculateBoneTransform(const AssimpNodeData* node, glm::mat4 parentTransform)
 	{
-		std::string nodeName = node->name;
+		CalculateBoneTransform(node, parentTransform, m_SharedPalette ? m_SharedPalette->GetBackBuffer() : m_FinalBoneMatrices.data());
+	}
+
+	void CalculateBoneTransform(const AssimpNodeData* node, const glm::mat4& parentTransform, glm::mat4* palette)
+	{
+		CalculateBoneTransform(node, parentTransform, palette, m_CurrentTime);
+	}
+
+	// latest completed palette, one matrix per bone of the current animation. With a shared
+	// palette this is the reader side: call it from the one reading thread only, and a returned
+	// palette stays untouched until that thread calls it again
+	const std::vector<glm::mat4>& GetFinalBoneMatrices() const
+	{
+		return m_SharedPalette ? m_SharedPalette->GetFront() : m_FinalBoneMatrices;
+	}
+
+	BonePaletteView GetPalette() const { return GetFinalBoneMatrices(); }
+	int GetBoneCount() const { return (int)(m_SharedPalette ? m_SharedPalette->GetBoneCount() : m_FinalBoneMatrices.size()); }
+
+private:
+	void CalculateBoneTransform(const AssimpNodeData* node, const glm::mat4& parentTransform, glm::mat4* palette, float animationTime)
+	{
 		glm::mat4 nodeTransform = node->transformation;
 
-		Bone* Bone = m_CurrentAnimation->FindBone(nodeName);
+		int handle = node->boneHandle;
 
-		if (Bone)
-		{
-			Bone->Update(m_CurrentTime);
-			nodeTransform = Bone->GetLocalTransform();
-		}
+		// sample without writing back into the Bone: the Animation may be shared between animators
+		Bone* bone = handle >= 0 ? m_CurrentAnimation->GetBone(handle) : nullptr;
+		if (bone)
+			nodeTransform = bone->SampleLocalTransform(animationTime);
 
 		glm::mat4 globalTransformation = parentTransform * nodeTransform;
 
-		auto boneInfoMap = m_CurrentAnimation->GetBoneIDMap();
-		if (boneInfoMap.find(nodeName) != boneInfoMap.end())
-		{
-			int index = boneInfoMap[nodeName].id;
-			glm::mat4 offset = boneInfoMap[nodeName].offset;
-			m_FinalBoneMatrices[index] = globalTransformation * offset;
-		}
+		if (handle >= 0)
+			palette[handle] = globalTransformation * m_CurrentAnimation->GetBoneOffset(handle);
 
 		for (int i = 0; i < node->childrenCount; i++)
-			CalculateBoneTransform(&node->children[i], globalTransformation);
+			CalculateBoneTransform(&node->children[i], globalTransformation, palette, animationTime);
 	}
 
-	std::vector<glm::mat4> GetFinalBoneMatrices()
+	// palettes are sized to the skeleton; PlayAnimation must not race a reader of a shared palette
+	void ResizePalette()
 	{
-		return m_FinalBoneMatrices;
+		size_t boneCount = m_CurrentAnimation ? m_CurrentAnimation->GetBoneCount() : 0;
+		if (m_SharedPalette)
+			m_SharedPalette->Resize(boneCount);
+		else
+			m_FinalBoneMatrices.assign(boneCount, glm::mat4(1.0f));
+
+		ResizeKeyPoses();
+	}
+
+	void ResizeKeyPoses()
+	{
+		size_t boneCount = m_CurrentAnimation ? m_CurrentAnimation->GetBoneCount() : 0;
+		for (auto& keyPose : m_KeyPoses)
+		{
+			if (m_UpdateInterval > 1)
+				keyPose.assign(boneCount, glm::mat4(1.0f));
+			else
+				std::vector<glm::mat4>().swap(keyPose);
+		}
 	}
 
-private:
 	std::vector<glm::mat4> m_FinalBoneMatrices;
+	std::unique_ptr<SharedPalette> m_SharedPalette;
 	Animation* m_CurrentAnimation;
 	float m_CurrentTime;
 	float m_DeltaTime;
 
+	// update-rate LOD state; key poses are only allocated while the interval is above 1
+	std::vector<glm::mat4> m_KeyPoses[2];
+	int m_UpdateInterval = 1;
+	int m_FrameInInterval = 0;
+	int m_SegmentFrame = 0;  // frames since the first key pose was sampled
+	int m_SegmentLength = 1; // frames from the first key pose to the second
+	bool m_KeyPosesValid = false;
+
 };
\ No newline at end of file
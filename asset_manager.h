@@ -0,0 +1,371 @@
+#pragma once
+
+/* Streams models, animations and textures in on background threads */
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "animation.h"
+#include "model.h"
+#include "thread_pool.h"
+
+// stays valid for the lifetime of the AssetManager that returned it
+template <typename T>
+struct AssetHandle
+{
+	static constexpr uint32_t Invalid = 0xffffffffu;
+	uint32_t index = Invalid;
+
+	bool IsValid() const { return index != Invalid; }
+};
+
+using ModelHandle = AssetHandle<Model>;
+using AnimationHandle = AssetHandle<Animation>;
+using TextureHandle = AssetHandle<Texture>;
+
+enum class AssetState
+{
+	Loading,
+	Resident,
+	Failed
+};
+
+// Load* return a handle immediately and do all file IO and CPU processing on the pool. Finished
+// assets are uploaded to GL by Update, on the context thread, a few per frame; until then the
+// getters hand out a placeholder cube and a 1x1 white texture.
+class AssetManager
+{
+public:
+	// needs a current GL context for the placeholders; the pool is not owned
+	explicit AssetManager(ThreadPool& pool)
+		: m_Pool(pool)
+	{
+		CreatePlaceholders();
+	}
+
+	~AssetManager()
+	{
+		Clear();
+	}
+
+	AssetManager(const AssetManager&) = delete;
+	AssetManager& operator=(const AssetManager&) = delete;
+
+	ModelHandle LoadModel(const std::string& path, const ModelImportOptions& options = ModelImportOptions(), bool gamma = false)
+	{
+		ModelImportOptions importOptions = options;
+		if (!importOptions.threadPool)
+			importOptions.threadPool = &m_Pool; // ParallelFor from a pool job is fine, the caller takes chunks too
+
+		m_Models.emplace_back(new ModelRecord());
+		ModelRecord* record = m_Models.back().get();
+		record->path = path;
+		record->model.reset(new Model(importOptions, gamma));
+
+		BeginJob();
+		m_Pool.Submit([this, record]()
+		{
+			bool imported = record->model->Import(record->path);
+
+			std::vector<std::function<void()>> waiting;
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				record->imported = true;
+				record->importSucceeded = imported;
+				waiting.swap(record->waitingJobs);
+				m_Ready.push_back([record, imported]()
+				{
+					if (imported)
+						record->model->Upload();
+					record->state = imported ? AssetState::Resident : AssetState::Failed;
+				});
+			}
+			for (auto& job : waiting)
+				m_Pool.Submit(std::move(job));
+			EndJob();
+		});
+
+		ModelHandle handle;
+		handle.index = (uint32_t)(m_Models.size() - 1);
+		return handle;
+	}
+
+	// animations add their missing bones to the model, so the file is only read once the model
+	// has been imported
+	AnimationHandle LoadAnimation(const std::string& path, ModelHandle model)
+	{
+		assert(model.IsValid() && model.index < m_Models.size());
+		ModelRecord* modelRecord = m_Models[model.index].get();
+
+		m_Animations.emplace_back(new AnimationRecord());
+		AnimationRecord* record = m_Animations.back().get();
+		record->path = path;
+
+		std::function<void()> job = [this, record, modelRecord]()
+		{
+			// importSucceeded was written before this job could start
+			bool loaded = false;
+			if (modelRecord->importSucceeded)
+			{
+				std::lock_guard<std::mutex> bonesLock(modelRecord->bonesMutex);
+				record->animation.reset(new Animation());
+				loaded = record->animation->Load(record->path, modelRecord->model.get());
+			}
+			else
+			{
+				std::cout << "ERROR::ASSET_MANAGER:: not loading " << record->path << ", its model failed to import" << std::endl;
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Ready.push_back([record, loaded]() { record->state = loaded ? AssetState::Resident : AssetState::Failed; });
+			}
+			EndJob();
+		};
+
+		BeginJob();
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (!modelRecord->imported)
+			{
+				modelRecord->waitingJobs.push_back(job);
+				job = nullptr;
+			}
+		}
+		if (job)
+			m_Pool.Submit(job);
+
+		AnimationHandle handle;
+		handle.index = (uint32_t)(m_Animations.size() - 1);
+		return handle;
+	}
+
+	// path is used as given (unlike model textures, which are relative to the model directory)
+	TextureHandle LoadTexture(const std::string& path, const std::string& type = "texture_diffuse")
+	{
+		m_Textures.emplace_back(new TextureRecord());
+		TextureRecord* record = m_Textures.back().get();
+		size_t slash = path.find_last_of('/');
+		record->image.directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		record->image.path = path.substr(slash + 1);
+		record->image.type = type;
+		record->canonicalPath = CanonicalTexturePath(path);
+		record->texture.id = m_WhiteTexture;
+		record->texture.type = type;
+		record->texture.path = path;
+
+		BeginJob();
+		m_Pool.Submit([this, record]()
+		{
+			// a texture some model already holds only needs another reference
+			if (!TextureCache::Get().Contains(record->canonicalPath))
+				DecodeImage(record->image);
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Ready.push_back([record]()
+				{
+					unsigned int id = TextureCache::Get().Acquire(record->canonicalPath);
+					if (id == 0)
+					{
+						if (!record->image.data)
+							DecodeImage(record->image); // evicted since the check above
+						if (!record->image.data)
+						{
+							std::cout << "Texture failed to load at path: " << record->texture.path << std::endl;
+							record->state = AssetState::Failed;
+							return;
+						}
+						id = TextureCache::Get().Insert(record->canonicalPath, UploadTexture(record->image));
+					}
+					stbi_image_free(record->image.data);
+					record->image.data = nullptr;
+					record->texture.id = id;
+					record->state = AssetState::Resident;
+				});
+			}
+			EndJob();
+		});
+
+		TextureHandle handle;
+		handle.index = (uint32_t)(m_Textures.size() - 1);
+		return handle;
+	}
+
+	// call once per frame on the context thread; uploads at most maxUploads finished assets so
+	// a burst of completed loads is spread over several frames
+	void Update(int maxUploads = 2)
+	{
+		std::vector<std::function<void()>> uploads;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			size_t count = std::min(m_Ready.size(), (size_t)std::max(maxUploads, 0));
+			uploads.assign(std::make_move_iterator(m_Ready.begin()), std::make_move_iterator(m_Ready.begin() + count));
+			m_Ready.erase(m_Ready.begin(), m_Ready.begin() + count);
+		}
+		for (auto& upload : uploads)
+			upload();
+	}
+
+	// the model once resident, the placeholder cube before that or if loading failed
+	Model& GetModel(ModelHandle handle)
+	{
+		const ModelRecord& record = *m_Models[handle.index];
+		return record.state == AssetState::Resident ? *record.model : *m_PlaceholderModel;
+	}
+
+	// nullptr until resident
+	Animation* GetAnimation(AnimationHandle handle)
+	{
+		const AnimationRecord& record = *m_Animations[handle.index];
+		return record.state == AssetState::Resident ? record.animation.get() : nullptr;
+	}
+
+	// white until resident
+	const Texture& GetTexture(TextureHandle handle) const { return m_Textures[handle.index]->texture; }
+
+	// waits for running loads (they reference the asset records), then frees every asset and the
+	// placeholders. GL calls are involved, so call it while the context is still alive; handles
+	// returned before are invalid afterwards.
+	void Clear()
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Idle.wait(lock, [this] { return m_RunningJobs == 0; });
+			m_Ready.clear();
+		}
+
+		for (auto& record : m_Textures)
+		{
+			if (record->state == AssetState::Resident)
+				TextureCache::Get().Release(record->canonicalPath);
+			stbi_image_free(record->image.data);
+		}
+		m_Textures.clear();
+		m_Animations.clear();
+		m_Models.clear(); // models release their own textures
+
+		m_PlaceholderModel.reset();
+		if (m_WhiteTexture)
+		{
+			glDeleteTextures(1, &m_WhiteTexture);
+			m_WhiteTexture = 0;
+		}
+	}
+
+	AssetState GetState(ModelHandle handle) const { return m_Models[handle.index]->state; }
+	AssetState GetState(AnimationHandle handle) const { return m_Animations[handle.index]->state; }
+	AssetState GetState(TextureHandle handle) const { return m_Textures[handle.index]->state; }
+
+private:
+	// records are only created and state is only written on the context thread; jobs get a
+	// pointer to their record, which never moves
+	struct ModelRecord
+	{
+		std::string path;
+		std::unique_ptr<Model> model;
+		AssetState state = AssetState::Loading;
+		bool imported = false;                          // guarded by m_Mutex
+		bool importSucceeded = false;                   // set with imported, read by the waiting jobs
+		std::vector<std::function<void()>> waitingJobs; // guarded by m_Mutex, run once imported
+		std::mutex bonesMutex;                          // animations of one model register bones one at a time
+	};
+
+	struct AnimationRecord
+	{
+		std::string path;
+		std::unique_ptr<Animation> animation;
+		AssetState state = AssetState::Loading;
+	};
+
+	struct TextureRecord
+	{
+		std::string canonicalPath;
+		DecodedImage image;
+		Texture texture;
+		AssetState state = AssetState::Loading;
+	};
+
+	void BeginJob()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_RunningJobs++;
+	}
+
+	void EndJob()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_RunningJobs == 0)
+			m_Idle.notify_all();
+	}
+
+	void CreatePlaceholders()
+	{
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		glGenTextures(1, &m_WhiteTexture);
+		glBindTexture(GL_TEXTURE_2D, m_WhiteTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		// unit cube around the origin, four vertices per face so every face keeps its own normal
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int side = -1; side <= 1; side += 2)
+			{
+				glm::vec3 normal(0.0f), tangent(0.0f);
+				normal[axis] = (float)side;
+				tangent[(axis + 1) % 3] = 1.0f;
+				glm::vec3 bitangent = glm::cross(normal, tangent);
+
+				unsigned int first = (unsigned int)vertices.size();
+				const glm::vec2 corners[4] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+				for (const glm::vec2& corner : corners)
+				{
+					Vertex vertex;
+					vertex.Position = 0.5f * normal + (corner.x - 0.5f) * tangent + (corner.y - 0.5f) * bitangent;
+					vertex.Normal = normal;
+					vertex.TexCoords = corner;
+					vertex.Tangent = tangent;
+					vertex.Bitangent = bitangent;
+					for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+					{
+						vertex.m_BoneIDs[i] = -1;
+						vertex.m_Weights[i] = 0.0f;
+					}
+					vertices.push_back(vertex);
+				}
+				const unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+				for (unsigned int index : quad)
+					indices.push_back(first + index);
+			}
+		}
+
+		Texture texture;
+		texture.id = m_WhiteTexture;
+		texture.type = "texture_diffuse";
+		m_PlaceholderModel.reset(new Model(ModelImportOptions()));
+		m_PlaceholderModel->meshes.emplace_back(std::move(vertices), std::move(indices), vector<Texture>{ texture });
+		m_PlaceholderModel->boundsCenter = glm::vec3(0.0f);
+		m_PlaceholderModel->boundsRadius = 0.5f * std::sqrt(3.0f);
+	}
+
+	ThreadPool& m_Pool;
+
+	std::vector<std::unique_ptr<ModelRecord>> m_Models;
+	std::vector<std::unique_ptr<AnimationRecord>> m_Animations;
+	std::vector<std::unique_ptr<TextureRecord>> m_Textures;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Idle;
+	int m_RunningJobs = 0;                      // guarded by m_Mutex
+	std::vector<std::function<void()>> m_Ready; // guarded by m_Mutex, run by Update
+
+	unsigned int m_WhiteTexture = 0;
+	std::unique_ptr<Model> m_PlaceholderModel;
+};
@@ -37,7 +37,8 @@ public:
 		m_Name(name),
 		m_ID(ID),
 		m_LocalTransform(1.0f),
-		m_GlobalTransform(1.0f)
+		m_GlobalTransform(1.0f),
+		m_GlobalDirty(true)
 
 	{
 		if (channel == nullptr) {
@@ -80,11 +81,19 @@ public:
 	}
 
 	void Update(float animationTime)
+	{
+		m_LocalTransform = SampleLocalTransform(animationTime);
+		MarkGlobalDirty();
+	}
+
+	// samples the keyframes without touching the bone's own state, so several animators
+	// can evaluate the same Animation at different times concurrently
+	glm::mat4 SampleLocalTransform(float animationTime) const
 	{
 		glm::mat4 translation = InterpolatePosition(animationTime);
 		glm::mat4 rotation = InterpolateRotation(animationTime);
 		glm::mat4 scale = InterpolateScaling(animationTime);
-		m_LocalTransform = translation * rotation * scale;
+		return translation * rotation * scale;
 	}
 	glm::mat4 GetLocalTransform() const { return m_LocalTransform; }
 	std::string GetBoneName() const { return m_Name; }
@@ -93,7 +102,7 @@ public:
 	std::vector<KeyPosition> GetBonePosition() { return m_Positions; }
 
 
-	int GetPositionIndex(float animationTime)
+	int GetPositionIndex(float animationTime) const
 	{
 		for (int index = 0; index < m_NumPositions - 1; ++index)
 		{
@@ -103,7 +112,7 @@ public:
 		assert(0);
 	}
 
-	int GetRotationIndex(float animationTime)
+	int GetRotationIndex(float animationTime) const
 	{
 		for (int index = 0; index < m_NumRotations - 1; ++index)
 		{
@@ -113,7 +122,7 @@ public:
 		assert(0);
 	}
 
-	int GetScaleIndex(float animationTime)
+	int GetScaleIndex(float animationTime) const
 	{
 		for (int index = 0; index < m_NumScalings - 1; ++index)
 		{
@@ -126,8 +135,8 @@ public:
 	// һĿλø¹ת
 	void UpdateRotationTowardsTarget(const glm::vec3& targetPosition) {
 		if (m_Parent) { // ȷи
-			glm::vec3 boneDir = glm::normalize(glm::vec3(m_GlobalTransform[3]) - glm::vec3(m_Parent->m_GlobalTransform[3]));
-			glm::vec3 targetDir = glm::normalize(targetPosition - glm::vec3(m_Parent->m_GlobalTransform[3]));
+			glm::vec3 boneDir = glm::normalize(glm::vec3(GetGlobalTransform()[3]) - glm::vec3(m_Parent->GetGlobalTransform()[3]));
+			glm::vec3 targetDir = glm::normalize(targetPosition - glm::vec3(m_Parent->GetGlobalTransform()[3]));
 			float dot = glm::dot(boneDir, targetDir);
 			float angle = acos(dot);
 			// 򻯴ʵӦҪתת
@@ -143,11 +152,15 @@ public:
 		glm::mat4 scaleMat = glm::scale(glm::mat4(1.0f), GetScale());
 		glm::mat4 rotationMat = glm::toMat4(rotation);
 		m_LocalTransform = translationMat * rotationMat * scaleMat;
+		MarkGlobalDirty();
 	}
 
 	// ¹ȫֱ任
 	void UpdateGlobalTransform(const glm::mat4& parentTransform) {
 		m_GlobalTransform = parentTransform * m_LocalTransform;
+		// parentTransform may be anything, so the cache only counts as valid if the real parent's is:
+		// a dirty parent must keep this subtree dirty for MarkGlobalDirty's early out
+		m_GlobalDirty = m_Parent && m_Parent->m_GlobalDirty;
 		// ݹӹȫֱ任
 		for (Bone* child : m_Children) {
 			child->UpdateGlobalTransform(m_GlobalTransform);
@@ -170,31 +183,43 @@ public:
 	void AddChild(Bone* child) {
 		m_Children.push_back(child);
 		child->m_Parent = this; // ø
+		child->MarkGlobalDirty();
 	}
 
 	// ȡȫֱ任
 	glm::mat4 GetParentGlobalTransform() const {
 		if (m_Parent) {
-			return m_Parent->m_GlobalTransform;
+			return m_Parent->GetGlobalTransform();
 		}
 		return glm::mat4(1.0f); // ûиصλ
 	}
 
+	// cached; only recomputed (from the cached parent) after this bone or an ancestor changed
 	glm::mat4 GetGlobalTransform() const {
-		if (m_Parent == nullptr) {
-			return m_LocalTransform;
+		if (m_GlobalDirty) {
+			m_GlobalTransform = m_Parent ? m_Parent->GetGlobalTransform() * m_LocalTransform : m_LocalTransform;
+			m_GlobalDirty = false;
 		}
-		else {
-			return m_Parent->GetGlobalTransform() * m_LocalTransform;
+		return m_GlobalTransform;
+	}
+
+	// invalidates the cached global transform of this bone and its subtree. A dirty bone's
+	// descendants are always dirty too, so the walk stops at the first one already marked.
+	void MarkGlobalDirty() {
+		if (m_GlobalDirty)
+			return;
+		m_GlobalDirty = true;
+		for (Bone* child : m_Children) {
+			child->MarkGlobalDirty();
 		}
 	}
 
 	std::vector<Bone*> m_Children; // ӹ
-	Bone* m_Parent;
+	Bone* m_Parent = nullptr;
 
 private:
 
-	float GetScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime)
+	float GetScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime) const
 	{
 		float scaleFactor = 0.0f;
 		float midWayLength = animationTime - lastTimeStamp;
@@ -203,7 +228,7 @@ private:
 		return scaleFactor;
 	}
 
-	glm::mat4 InterpolatePosition(float animationTime)
+	glm::mat4 InterpolatePosition(float animationTime) const
 	{
 		if (1 == m_NumPositions)
 			return glm::translate(glm::mat4(1.0f), m_Positions[0].position);
@@ -217,7 +242,7 @@ private:
 		return glm::translate(glm::mat4(1.0f), finalPosition);
 	}
 
-	glm::mat4 InterpolateRotation(float animationTime)
+	glm::mat4 InterpolateRotation(float animationTime) const
 	{
 		if (1 == m_NumRotations)
 		{
@@ -236,7 +261,7 @@ private:
 
 	}
 
-	glm::mat4 InterpolateScaling(float animationTime)
+	glm::mat4 InterpolateScaling(float animationTime) const
 	{
 		if (1 == m_NumScalings)
 			return glm::scale(glm::mat4(1.0f), m_Scales[0].scale);
@@ -262,6 +287,7 @@ private:
 	int m_ID;
 
 	// Ա
-	glm::mat4 m_GlobalTransform;
+	mutable glm::mat4 m_GlobalTransform;
+	mutable bool m_GlobalDirty;
 
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+/* Interning table that maps bone names to dense integer handles */
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// handles are assigned in order of first appearance, starting at 0, so they can index
+// arrays directly; for skeletons they are the same numbers as BoneInfo::id
+class BoneNameTable
+{
+public:
+	static constexpr int InvalidHandle = -1;
+
+	int Intern(const std::string& name)
+	{
+		auto iter = m_Handles.find(name);
+		if (iter != m_Handles.end())
+			return iter->second;
+
+		int handle = (int)m_Names.size();
+		m_Handles.emplace(name, handle);
+		m_Names.push_back(name);
+		return handle;
+	}
+
+	int Find(const std::string& name) const
+	{
+		auto iter = m_Handles.find(name);
+		return iter == m_Handles.end() ? InvalidHandle : iter->second;
+	}
+
+	const std::string& GetName(int handle) const { return m_Names[handle]; }
+	int Size() const { return (int)m_Names.size(); }
+
+private:
+	std::unordered_map<std::string, int> m_Handles;
+	std::vector<std::string> m_Names;
+};
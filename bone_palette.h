@@ -0,0 +1,65 @@
+#pragma once
+
+/* Non-owning and shared views over bone matrix palettes */
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "triple_buffer.h"
+
+// read-only view over a contiguous run of bone matrices (final palette of one skeleton)
+class BonePaletteView
+{
+public:
+	BonePaletteView() = default;
+	BonePaletteView(const glm::mat4* data, size_t size) : m_Data(data), m_Size(size) {}
+	BonePaletteView(const std::vector<glm::mat4>& palette) : m_Data(palette.data()), m_Size(palette.size()) {}
+
+	const glm::mat4& operator[](size_t index) const { return m_Data[index]; }
+	const glm::mat4* Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+	bool Empty() const { return m_Size == 0; }
+
+	const glm::mat4* begin() const { return m_Data; }
+	const glm::mat4* end() const { return m_Data + m_Size; }
+
+private:
+	const glm::mat4* m_Data = nullptr;
+	size_t m_Size = 0;
+};
+
+// Palettes for one writer thread (simulation) and one reader thread (render), kept in a
+// TripleBuffer: the writer fills its own palette and publishes it, GetFront switches the reader
+// to the newest published one. Neither side ever touches the palette the other one holds, so a
+// reader may keep a view for as long as it likes; it stays valid until its next GetFront.
+class SharedPalette
+{
+public:
+	explicit SharedPalette(size_t boneCount = 0)
+	{
+		Resize(boneCount);
+	}
+
+	// not thread-safe: only call while the reader holds no view
+	void Resize(size_t boneCount)
+	{
+		m_Palettes.ForEachSlot([boneCount](std::vector<glm::mat4>& palette) { palette.assign(boneCount, glm::mat4(1.0f)); });
+		m_BoneCount = boneCount;
+	}
+
+	// writer side
+	glm::mat4* GetBackBuffer() { return m_Palettes.WriteBuffer().data(); }
+	void Publish() { m_Palettes.Publish(); }
+
+	// reader side: the newest published palette, or the one returned last time if nothing new was published
+	const std::vector<glm::mat4>& GetFront()
+	{
+		m_Palettes.Acquire();
+		return m_Palettes.ReadBuffer();
+	}
+
+	size_t GetBoneCount() const { return m_BoneCount; }
+
+private:
+	TripleBuffer<std::vector<glm::mat4>> m_Palettes;
+	size_t m_BoneCount = 0;
+};
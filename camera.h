@@ -67,6 +67,15 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // returns the approximate on-screen radius in pixels of a sphere, for picking a level of detail
+    float GetProjectedRadius(const glm::vec3& center, float radius, float viewportHeight) const
+    {
+        float distance = glm::length(center - Position);
+        if (distance <= radius)
+            return viewportHeight; // the camera is inside the sphere
+        return radius / (distance * tan(glm::radians(Zoom) * 0.5f)) * viewportHeight * 0.5f;
+    }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
@@ -0,0 +1,226 @@
+#pragma once
+
+/* CPU skinning of mesh vertices, for headless use such as collision and baking */
+
+#include <cassert>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "bone_palette.h"
+#include "mesh.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_SKINNING_SSE 1
+#endif
+
+enum class SkinningMode
+{
+	LinearBlend,
+	DualQuaternion
+};
+
+struct SkinnedGeometry
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+};
+
+class CpuSkinner
+{
+public:
+	// pool is not owned; without one the whole mesh is skinned on the calling thread
+	CpuSkinner(ThreadPool* pool = nullptr, size_t verticesPerChunk = 4096)
+		: m_Pool(pool), m_VerticesPerChunk(verticesPerChunk)
+	{
+	}
+
+	// skins vertices with the given palette (e.g. Animator::GetPalette()). Vertices without
+	// any bone influence are copied through unchanged.
+	void Skin(const std::vector<Vertex>& vertices, BonePaletteView palette, SkinningMode mode, SkinnedGeometry& out)
+	{
+		out.positions.resize(vertices.size());
+		out.normals.resize(vertices.size());
+
+		if (mode == SkinningMode::DualQuaternion)
+			ConvertPalette(palette);
+
+		const Vertex* source = vertices.data();
+		glm::vec3* positions = out.positions.data();
+		glm::vec3* normals = out.normals.data();
+		auto skinRange = [&](size_t begin, size_t end)
+		{
+			if (mode == SkinningMode::LinearBlend)
+				SkinLinearBlend(source, palette, positions, normals, begin, end);
+			else
+				SkinDualQuaternion(source, positions, normals, begin, end);
+		};
+
+		if (m_Pool)
+			m_Pool->ParallelFor(vertices.size(), m_VerticesPerChunk, skinRange);
+		else
+			skinRange(0, vertices.size());
+	}
+
+private:
+	// unit dual quaternion, both parts stored as (x, y, z, w)
+	struct DualQuat
+	{
+		glm::vec4 real;
+		glm::vec4 dual;
+	};
+
+	static void SkinLinearBlend(const Vertex* vertices, BonePaletteView palette, glm::vec3* positions, glm::vec3* normals, size_t begin, size_t end)
+	{
+		for (size_t v = begin; v < end; v++)
+		{
+			const Vertex& vertex = vertices[v];
+			const glm::vec3& p = vertex.Position;
+			const glm::vec3& n = vertex.Normal;
+
+#ifdef CPU_SKINNING_SSE
+			// blend the four columns of the weighted bone matrices, then transform
+			__m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+			float totalWeight = 0.0f;
+			for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+			{
+				int id = vertex.m_BoneIDs[i];
+				float weight = vertex.m_Weights[i];
+				if (id < 0 || weight <= 0.0f)
+					continue;
+				assert((size_t)id < palette.Size());
+
+				const float* m = &palette[id][0][0];
+				__m128 w = _mm_set1_ps(weight);
+				c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+				c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+				c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+				c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+				totalWeight += weight;
+			}
+
+			if (totalWeight <= 0.0f)
+			{
+				positions[v] = p;
+				normals[v] = n;
+				continue;
+			}
+
+			__m128 xyz = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y)));
+			xyz = _mm_add_ps(xyz, _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+			__m128 nrm = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)), _mm_mul_ps(c1, _mm_set1_ps(n.y)));
+			nrm = _mm_add_ps(nrm, _mm_mul_ps(c2, _mm_set1_ps(n.z)));
+
+			float result[4];
+			_mm_storeu_ps(result, xyz);
+			positions[v] = glm::vec3(result[0], result[1], result[2]);
+			_mm_storeu_ps(result, nrm);
+			normals[v] = glm::normalize(glm::vec3(result[0], result[1], result[2]));
+#else
+			glm::mat4 skin(0.0f);
+			float totalWeight = 0.0f;
+			for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+			{
+				int id = vertex.m_BoneIDs[i];
+				float weight = vertex.m_Weights[i];
+				if (id < 0 || weight <= 0.0f)
+					continue;
+				assert((size_t)id < palette.Size());
+
+				skin += palette[id] * weight;
+				totalWeight += weight;
+			}
+
+			if (totalWeight <= 0.0f)
+			{
+				positions[v] = p;
+				normals[v] = n;
+				continue;
+			}
+
+			positions[v] = glm::vec3(skin * glm::vec4(p, 1.0f));
+			normals[v] = glm::normalize(glm::mat3(skin) * n);
+#endif
+		}
+	}
+
+	void SkinDualQuaternion(const Vertex* vertices, glm::vec3* positions, glm::vec3* normals, size_t begin, size_t end) const
+	{
+		for (size_t v = begin; v < end; v++)
+		{
+			const Vertex& vertex = vertices[v];
+
+			glm::vec4 real(0.0f), dual(0.0f);
+			glm::vec4 pivot(0.0f);
+			bool hasPivot = false;
+			for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+			{
+				int id = vertex.m_BoneIDs[i];
+				float weight = vertex.m_Weights[i];
+				if (id < 0 || weight <= 0.0f)
+					continue;
+				assert((size_t)id < m_DualQuats.size());
+
+				// keep every rotation in the same hemisphere as the first one (shortest path)
+				const DualQuat& dq = m_DualQuats[id];
+				if (!hasPivot)
+				{
+					pivot = dq.real;
+					hasPivot = true;
+				}
+				if (glm::dot(pivot, dq.real) < 0.0f)
+					weight = -weight;
+
+#ifdef CPU_SKINNING_SSE
+				__m128 w = _mm_set1_ps(weight);
+				_mm_storeu_ps(&real[0], _mm_add_ps(_mm_loadu_ps(&real[0]), _mm_mul_ps(w, _mm_loadu_ps(&dq.real[0]))));
+				_mm_storeu_ps(&dual[0], _mm_add_ps(_mm_loadu_ps(&dual[0]), _mm_mul_ps(w, _mm_loadu_ps(&dq.dual[0]))));
+#else
+				real += dq.real * weight;
+				dual += dq.dual * weight;
+#endif
+			}
+
+			float length = glm::length(real);
+			if (!hasPivot || length <= 0.0f)
+			{
+				positions[v] = vertex.Position;
+				normals[v] = vertex.Normal;
+				continue;
+			}
+			real /= length;
+			dual /= length;
+
+			glm::vec3 r(real), d(dual);
+			const glm::vec3& p = vertex.Position;
+			const glm::vec3& n = vertex.Normal;
+			glm::vec3 rotated = p + 2.0f * glm::cross(r, glm::cross(r, p) + real.w * p);
+			glm::vec3 translation = 2.0f * (real.w * d - dual.w * r + glm::cross(r, d));
+			positions[v] = rotated + translation;
+			normals[v] = glm::normalize(n + 2.0f * glm::cross(r, glm::cross(r, n) + real.w * n));
+		}
+	}
+
+	// one dual quaternion per bone; scale/shear in the palette is dropped, as DQ skinning assumes rigid bones
+	void ConvertPalette(BonePaletteView palette)
+	{
+		m_DualQuats.resize(palette.Size());
+		for (size_t i = 0; i < palette.Size(); i++)
+		{
+			const glm::mat4& m = palette[i];
+			glm::mat3 rotation(glm::normalize(glm::vec3(m[0])), glm::normalize(glm::vec3(m[1])), glm::normalize(glm::vec3(m[2])));
+			glm::quat q = glm::normalize(glm::quat_cast(rotation));
+			glm::vec3 t(m[3]);
+
+			// dual part = 0.5 * (0, t) * q
+			glm::quat d = glm::quat(0.0f, t.x, t.y, t.z) * q * 0.5f;
+			m_DualQuats[i].real = glm::vec4(q.x, q.y, q.z, q.w);
+			m_DualQuats[i].dual = glm::vec4(d.x, d.y, d.z, d.w);
+		}
+	}
+
+	ThreadPool* m_Pool;
+	size_t m_VerticesPerChunk;
+	std::vector<DualQuat> m_DualQuats;
+};
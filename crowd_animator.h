@@ -0,0 +1,76 @@
+#pragma once
+
+/* Updates many animator instances in parallel into one shared bone palette */
+
+#include <cassert>
+#include <vector>
+#include <glm/glm.hpp>
+#include "animation_lod.h"
+#include "animator.h"
+#include "bone_palette.h"
+#include "thread_pool.h"
+
+class CrowdAnimator
+{
+public:
+	// instance i owns palette entries [i * bonesPerInstance, (i + 1) * bonesPerInstance),
+	// so the whole crowd can be uploaded with a single buffer update.
+	// pool is not owned; without one every instance is updated on the calling thread.
+	CrowdAnimator(int bonesPerInstance, ThreadPool* pool = nullptr, size_t instancesPerChunk = 32)
+		: m_BonesPerInstance(bonesPerInstance), m_Pool(pool), m_InstancesPerChunk(instancesPerChunk)
+	{
+	}
+
+	int AddInstance(Animation* animation)
+	{
+		assert(animation == nullptr || animation->GetBoneCount() <= m_BonesPerInstance);
+
+		m_Animators.emplace_back(animation);
+		m_Palette.resize(m_Animators.size() * m_BonesPerInstance, glm::mat4(1.0f));
+		m_Positions.push_back(glm::vec3(0.0f));
+		return (int)m_Animators.size() - 1;
+	}
+
+	// world-space centre of an instance, used for update-rate LOD
+	void SetInstancePosition(int instance, const glm::vec3& position) { m_Positions[instance] = position; }
+
+	// picks every instance's update interval from its projected size; instance indices are
+	// used as phase so that reduced-rate instances don't all do their full update on the same frame
+	void UpdateLOD(const Camera& camera, float boundingRadius, float viewportHeight,
+		const AnimationLODSettings& settings = AnimationLODSettings())
+	{
+		for (size_t i = 0; i < m_Animators.size(); i++)
+		{
+			int interval = SelectAnimationUpdateInterval(camera, m_Positions[i], boundingRadius, viewportHeight, settings);
+			m_Animators[i].SetUpdateInterval(interval, (int)i);
+		}
+	}
+
+	void UpdateAnimation(float dt)
+	{
+		auto updateRange = [this, dt](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				m_Animators[i].UpdateAnimation(dt, &m_Palette[i * m_BonesPerInstance]);
+		};
+
+		if (m_Pool)
+			m_Pool->ParallelFor(m_Animators.size(), m_InstancesPerChunk, updateRange);
+		else
+			updateRange(0, m_Animators.size());
+	}
+
+	Animator& GetAnimator(int instance) { return m_Animators[instance]; }
+	BonePaletteView GetInstancePalette(int instance) const { return BonePaletteView(&m_Palette[instance * m_BonesPerInstance], m_BonesPerInstance); }
+	BonePaletteView GetPalette() const { return m_Palette; }
+	int GetInstanceCount() const { return (int)m_Animators.size(); }
+	int GetBonesPerInstance() const { return m_BonesPerInstance; }
+
+private:
+	std::vector<Animator> m_Animators;
+	std::vector<glm::mat4> m_Palette;
+	std::vector<glm::vec3> m_Positions;
+	int m_BonesPerInstance;
+	ThreadPool* m_Pool;
+	size_t m_InstancesPerChunk;
+};
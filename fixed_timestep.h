@@ -0,0 +1,60 @@
+#pragma once
+
+/* Fixed-timestep simulation clock with an accumulator */
+
+#include <algorithm>
+
+// Real frame time is fed in with Advance, which answers how many fixed steps the simulation has
+// to take to catch up. What is left over is less than one step; Alpha says how far between the
+// last two simulated states the frame is, so rendering can interpolate instead of showing the
+// simulation's stair-steps.
+//
+//   int steps = clock.Advance(frameSeconds);
+//   for (int i = 0; i < steps; i++) { previous = current; Simulate(current, clock.Step()); }
+//   Render(Interpolate(previous, current, clock.Alpha()));
+class FixedTimestep
+{
+public:
+	explicit FixedTimestep(double step = 1.0 / 120.0, int maxSubsteps = 8)
+		: m_Step(step), m_MaxSubsteps(std::max(maxSubsteps, 1))
+	{
+	}
+
+	// returns the number of steps to simulate for frameTime seconds of real time. At most
+	// maxSubsteps are taken; the time past that is dropped, so after a long stall (a breakpoint,
+	// a window drag) the simulation runs slower for a frame instead of spending ever longer
+	// catching up.
+	int Advance(double frameTime)
+	{
+		m_Accumulator += std::max(frameTime, 0.0);
+		int steps = (int)(m_Accumulator / m_Step);
+		if (steps > m_MaxSubsteps)
+		{
+			m_DroppedTime += (steps - m_MaxSubsteps) * m_Step;
+			m_Accumulator -= (steps - m_MaxSubsteps) * m_Step;
+			steps = m_MaxSubsteps;
+		}
+		m_Accumulator -= steps * m_Step;
+		m_Time += steps * m_Step;
+		m_StepCount += steps;
+		return steps;
+	}
+
+	// interpolation factor in [0, 1) between the state before the last step and after it
+	float Alpha() const { return (float)(m_Accumulator / m_Step); }
+
+	double Step() const { return m_Step; }
+	// simulated seconds, advanced by whole steps only
+	double Time() const { return m_Time; }
+	unsigned long long StepCount() const { return m_StepCount; }
+	// real time that was never simulated because of the substep clamp
+	double DroppedTime() const { return m_DroppedTime; }
+
+private:
+	double m_Step;
+	int m_MaxSubsteps;
+	double m_Accumulator = 0.0;
+	double m_Time = 0.0;
+	double m_DroppedTime = 0.0;
+	unsigned long long m_StepCount = 0;
+};
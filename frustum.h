@@ -0,0 +1,134 @@
+#pragma once
+
+/* View-frustum planes and bounding sphere culling */
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+// Six planes (a, b, c, d) with normalized (a, b, c) pointing inwards, so a point p is inside a
+// plane when dot(abc, p) + d >= 0. Extracted from a combined projection * view matrix the
+// Gribb/Hartmann way: each plane is the fourth row of the matrix plus or minus one of the
+// others, which gives world-space planes directly.
+struct Frustum
+{
+	enum Plane { Left, Right, Bottom, Top, Near, Far, PlaneCount };
+
+	glm::vec4 planes[PlaneCount];
+
+	static Frustum FromMatrix(const glm::mat4& viewProjection)
+	{
+		// glm is column major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		const glm::mat4& m = viewProjection;
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum frustum;
+		frustum.planes[Left] = row3 + row0;
+		frustum.planes[Right] = row3 - row0;
+		frustum.planes[Bottom] = row3 + row1;
+		frustum.planes[Top] = row3 - row1;
+		frustum.planes[Near] = row3 + row2; // OpenGL clip space, -w <= z <= w
+		frustum.planes[Far] = row3 - row2;
+		for (glm::vec4& plane : frustum.planes)
+		{
+			float length = glm::length(glm::vec3(plane));
+			if (length > 0.0f)
+				plane /= length;
+		}
+		return frustum;
+	}
+
+	// conservative: a sphere near a frustum corner may pass while being outside
+	bool IntersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+				return false;
+		}
+		return true;
+	}
+};
+
+// world-space bounding spheres as separate coordinate arrays, so CullSpheres can test four at once
+struct SphereList
+{
+	std::vector<float> x, y, z, radius;
+
+	void Clear()
+	{
+		x.clear();
+		y.clear();
+		z.clear();
+		radius.clear();
+	}
+
+	void Add(const glm::vec3& center, float r)
+	{
+		x.push_back(center.x);
+		y.push_back(center.y);
+		z.push_back(center.z);
+		radius.push_back(r);
+	}
+
+	size_t Size() const { return radius.size(); }
+};
+
+// replaces visible with the indices of the spheres that intersect the frustum, in order, and
+// returns how many were culled
+inline size_t CullSpheres(const Frustum& frustum, const SphereList& spheres, std::vector<uint32_t>& visible)
+{
+	size_t count = spheres.Size();
+	visible.clear();
+	size_t i = 0;
+
+#ifdef FRUSTUM_SSE
+	__m128 planeX[Frustum::PlaneCount], planeY[Frustum::PlaneCount], planeZ[Frustum::PlaneCount], planeW[Frustum::PlaneCount];
+	for (int p = 0; p < Frustum::PlaneCount; p++)
+	{
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&spheres.x[i]);
+		__m128 y = _mm_loadu_ps(&spheres.y[i]);
+		__m128 z = _mm_loadu_ps(&spheres.z[i]);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+		// a lane is culled once any plane has the whole sphere behind it
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < Frustum::PlaneCount; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y));
+			distance = _mm_add_ps(distance, _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negRadius));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(mask & (1 << lane)))
+				visible.push_back((uint32_t)(i + lane));
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		if (frustum.IntersectsSphere(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]))
+			visible.push_back((uint32_t)i);
+	}
+	return count - visible.size();
+}
@@ -0,0 +1,539 @@
+// Renders a scripted IK scene without a window, for timing on machines that have no GPU or
+// display (Mesa llvmpipe). The GL 3.3 core context comes from EGL on Mesa's surfaceless platform,
+// or from OSMesa when built with IK_HEADLESS_OSMESA; every frame is drawn into a framebuffer
+// object with the same instanced path main.cpp uses.
+//
+//   headless_benchmark [--frames N] [--warmup N] [--width W] [--height H] [--model path]
+//                      [--write out.ppm] [--compare reference.ppm] [--tolerance rmse]
+//
+// Prints CPU and GPU (GL_TIME_ELAPSED) frame time statistics in milliseconds. The scene only
+// depends on the frame number, so --write stores the last frame as a reference image and
+// --compare checks the last frame against one: it prints the RMSE (0-255 per channel) and exits
+// with 1 if it is above --tolerance.
+
+#include <glad/glad.h>
+#ifdef IK_HEADLESS_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "shader.h"
+#include "camera.h"
+#include "model.h"
+#include "asset_manager.h"
+#include "uniform_buffer.h"
+#include "IKbone.h"
+
+#include "stb_image.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// simulated time per frame; the script is tied to it, not to how fast frames are rendered
+const float SCRIPT_TIMESTEP = 1.0f / 60.0f;
+// timer results are read this many frames after they were issued so the CPU never waits on them
+const int TIMER_QUERY_COUNT = 4;
+
+struct BenchmarkOptions {
+    int frames = 600;
+    int warmup = 60;
+    int width = 800;
+    int height = 600;
+    std::string modelPath = "bone/newBone.obj";
+    std::string writePath;
+    std::string comparePath;
+    double tolerance = 2.0;
+};
+
+struct FrameStats {
+    double min = 0.0;
+    double mean = 0.0;
+    double median = 0.0;
+    double p95 = 0.0;
+    double max = 0.0;
+};
+
+// context without any window or surface, rendering goes to an FBO
+class HeadlessContext {
+public:
+    bool create(int width, int height)
+    {
+#ifdef IK_HEADLESS_OSMESA
+        const int attribs[] = {
+            OSMESA_FORMAT, OSMESA_RGBA,
+            OSMESA_DEPTH_BITS, 24,
+            OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+            OSMESA_CONTEXT_MAJOR_VERSION, 3,
+            OSMESA_CONTEXT_MINOR_VERSION, 3,
+            0
+        };
+        context = OSMesaCreateContextAttribs(attribs, NULL);
+        if (!context)
+        {
+            std::cout << "ERROR::HEADLESS:: failed to create an OSMesa 3.3 core context" << std::endl;
+            return false;
+        }
+        // OSMesa needs a color buffer to make the context current, even though nothing is drawn to it
+        buffer.resize((size_t)width * height * 4);
+        if (!OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, width, height))
+        {
+            std::cout << "ERROR::HEADLESS:: OSMesaMakeCurrent failed" << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc)OSMesaGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+#else
+        (void)width;
+        (void)height;
+        // the surfaceless platform needs neither a display server nor a GPU
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            std::cout << "ERROR::HEADLESS:: failed to initialize an EGL display" << std::endl;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cout << "ERROR::HEADLESS:: EGL has no desktop OpenGL support" << std::endl;
+            return false;
+        }
+
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_DONT_CARE, // no surface is ever created
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "ERROR::HEADLESS:: no EGL config for desktop OpenGL" << std::endl;
+            return false;
+        }
+
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+            EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            std::cout << "ERROR::HEADLESS:: failed to make an EGL 3.3 core context current (EGL " << major << "." << minor << ")" << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void destroy()
+    {
+#ifdef IK_HEADLESS_OSMESA
+        if (context)
+            OSMesaDestroyContext(context);
+        context = NULL;
+#else
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+        context = EGL_NO_CONTEXT;
+        display = EGL_NO_DISPLAY;
+#endif
+    }
+
+private:
+#ifdef IK_HEADLESS_OSMESA
+    OSMesaContext context = NULL;
+    std::vector<unsigned char> buffer;
+#else
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// color + depth renderbuffers the benchmark draws into
+class OffscreenTarget {
+public:
+    unsigned int framebuffer = 0;
+
+    bool create(int width, int height)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::HEADLESS:: framebuffer is not complete" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void destroy()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (framebuffer)
+            glDeleteFramebuffers(1, &framebuffer);
+        if (color)
+            glDeleteRenderbuffers(1, &color);
+        if (depth)
+            glDeleteRenderbuffers(1, &depth);
+        framebuffer = color = depth = 0;
+    }
+
+private:
+    unsigned int color = 0, depth = 0;
+};
+
+bool parseArguments(int argc, char** argv, BenchmarkOptions& options);
+glm::vec3 scriptedTarget(float time);
+FrameStats summarize(std::vector<double> samples);
+void printStats(const char* label, const FrameStats& stats);
+std::vector<unsigned char> readFramebuffer(int width, int height);
+bool writePPM(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb);
+bool readPPM(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb);
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    if (!parseArguments(argc, argv, options))
+        return 2;
+
+    HeadlessContext context;
+    if (!context.create(options.width, options.height))
+    {
+        context.destroy();
+        return 1;
+    }
+    std::cout << "GL_RENDERER: " << glGetString(GL_RENDERER) << std::endl;
+
+    stbi_set_flip_vertically_on_load(true);
+    glEnable(GL_DEPTH_TEST);
+
+    OffscreenTarget target;
+    if (!target.create(options.width, options.height))
+    {
+        target.destroy();
+        context.destroy();
+        return 1;
+    }
+
+    // same program and shared state as main.cpp, with a fragment shader that lives in the tree
+    Shader modelShader("vertexShaders/IK_instanced_vs.txt", "fragmentShaders/benchmark_fs.txt");
+    UniformBuffer<CameraBlock> cameraBuffer(CAMERA_BLOCK_BINDING);
+    UniformBuffer<LightBlock> lightBuffer(LIGHT_BLOCK_BINDING);
+    modelShader.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+    modelShader.bindUniformBlock("Light", LIGHT_BLOCK_BINDING);
+    lightBuffer.update({ glm::vec4(16.0f, -10.0f, -7.0f, 0.0f), glm::vec4(1.0f), glm::vec4(0.3f), glm::vec4(0.5f), glm::vec4(0.2f) });
+    modelShader.use();
+    modelShader.setVec3("diffuse_color", glm::vec3(1.0f, 1.0f, 0.8f));
+    modelShader.setVec3("specular_color", glm::vec3(1.0f));
+
+    // loading is not part of the measurement, wait until the model is resident (or failed, in
+    // which case the placeholder cube is benchmarked instead)
+    ThreadPool importPool;
+    AssetManager assets(importPool);
+    ModelImportOptions importOptions;
+    importOptions.lodLevels = 4;
+    importOptions.releaseCPUData = true;
+    ModelHandle boneModelHandle = assets.LoadModel(options.modelPath, importOptions);
+    while (assets.GetState(boneModelHandle) == AssetState::Loading)
+    {
+        assets.Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (assets.GetState(boneModelHandle) == AssetState::Failed)
+        std::cout << "benchmarking the placeholder cube, " << options.modelPath << " failed to load" << std::endl;
+    Model& boneModel = assets.GetModel(boneModelHandle);
+
+    Camera camera(glm::vec3(0.0f, 1.0f, 3.0f));
+    IKClass ikSolver;
+    ikSolver.chain.addJoint(IKJoint(glm::vec3(0.0f, 0.0f, 0.0f)));
+    ikSolver.chain.addJoint(IKJoint(glm::vec3(0.5f, 0.0f, 0.0f)));
+    ikSolver.chain.addJoint(IKJoint(glm::vec3(1.0f, 0.0f, 0.0f)));
+    ikSolver.chain.addJoint(IKJoint(glm::vec3(1.5f, 0.0f, 0.0f)));
+
+    std::vector<glm::mat4> jointInstances[4];
+    std::vector<glm::mat4> instanceTransforms;
+
+    unsigned int timerQueries[TIMER_QUERY_COUNT];
+    glGenQueries(TIMER_QUERY_COUNT, timerQueries);
+    std::vector<double> cpuTimes, gpuTimes;
+    cpuTimes.reserve(options.frames);
+    gpuTimes.reserve(options.frames);
+
+    int totalFrames = options.warmup + options.frames;
+    auto collectTimer = [&](int frame)
+    {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQueries[frame % TIMER_QUERY_COUNT], GL_QUERY_RESULT, &elapsed);
+        if (frame >= options.warmup)
+            gpuTimes.push_back(elapsed / 1.0e6);
+    };
+
+    auto benchmarkStart = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < totalFrames; frame++)
+    {
+        if (frame == options.warmup)
+            benchmarkStart = std::chrono::steady_clock::now();
+        if (frame >= TIMER_QUERY_COUNT)
+            collectTimer(frame - TIMER_QUERY_COUNT);
+
+        auto frameStart = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[frame % TIMER_QUERY_COUNT]);
+
+        // scripted update
+        ikSolver.setTarget(scriptedTarget(frame * SCRIPT_TIMESTEP));
+        ikSolver.applyCCD();
+
+        // render
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        glViewport(0, 0, options.width, options.height);
+        glClearColor(0.1f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        modelShader.use();
+        CameraBlock cameraData;
+        cameraData.projection = glm::perspective(glm::radians(camera.Zoom), (float)options.width / (float)options.height, 0.1f, 100.0f);
+        cameraData.view = camera.GetViewMatrix();
+        cameraData.viewPos = glm::vec4(camera.Position, 1.0f);
+        cameraBuffer.update(cameraData);
+
+        for (auto& instances : jointInstances)
+            instances.clear();
+        for (const auto& joint : ikSolver.chain.joints) {
+            glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), joint.position) * glm::toMat4(joint.globalRotation);
+            jointInstances[boneModel.SelectLOD(camera, modelMatrix, (float)options.height)].push_back(modelMatrix);
+        }
+        instanceTransforms.clear();
+        for (const auto& instances : jointInstances)
+            instanceTransforms.insert(instanceTransforms.end(), instances.begin(), instances.end());
+        boneModel.SetInstanceTransforms(instanceTransforms);
+        size_t firstInstance = 0;
+        for (int lod = 0; lod < 4; lod++) {
+            boneModel.DrawInstanced(modelShader, firstInstance, jointInstances[lod].size(), lod);
+            firstInstance += jointInstances[lod].size();
+        }
+
+        glEndQuery(GL_TIME_ELAPSED);
+        // CPU time is the cost of issuing the frame; the GPU time comes from the timer query
+        if (frame >= options.warmup)
+            cpuTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+    }
+    glFinish();
+    double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - benchmarkStart).count();
+    for (int frame = std::max(totalFrames - TIMER_QUERY_COUNT, 0); frame < totalFrames; frame++)
+        collectTimer(frame);
+    glDeleteQueries(TIMER_QUERY_COUNT, timerQueries);
+
+    std::cout << options.frames << " frames at " << options.width << "x" << options.height << " after " << options.warmup << " warm-up frames" << std::endl;
+    printStats("cpu", summarize(cpuTimes));
+    printStats("gpu", summarize(gpuTimes));
+    if (options.frames > 0)
+        std::cout << "wall: " << totalMs / options.frames << " ms/frame (" << 1000.0 * options.frames / totalMs << " fps)" << std::endl;
+
+    // last frame readback
+    int result = 0;
+    if (!options.writePath.empty() || !options.comparePath.empty())
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        std::vector<unsigned char> image = readFramebuffer(options.width, options.height);
+        if (!options.writePath.empty() && !writePPM(options.writePath, options.width, options.height, image))
+        {
+            std::cout << "ERROR::HEADLESS:: failed to write " << options.writePath << std::endl;
+            result = 1;
+        }
+        if (!options.comparePath.empty())
+        {
+            int referenceWidth = 0, referenceHeight = 0;
+            std::vector<unsigned char> reference;
+            if (!readPPM(options.comparePath, referenceWidth, referenceHeight, reference))
+            {
+                std::cout << "ERROR::HEADLESS:: failed to read reference image " << options.comparePath << std::endl;
+                result = 1;
+            }
+            else if (referenceWidth != options.width || referenceHeight != options.height)
+            {
+                std::cout << "ERROR::HEADLESS:: reference image is " << referenceWidth << "x" << referenceHeight << std::endl;
+                result = 1;
+            }
+            else
+            {
+                double sum = 0.0;
+                for (size_t i = 0; i < image.size(); i++)
+                {
+                    double difference = (double)image[i] - (double)reference[i];
+                    sum += difference * difference;
+                }
+                double rmse = std::sqrt(sum / image.size());
+                bool passed = rmse <= options.tolerance;
+                std::cout << "rmse: " << rmse << (passed ? " (pass)" : " (FAIL)") << ", tolerance " << options.tolerance << std::endl;
+                if (!passed)
+                    result = 1;
+            }
+        }
+    }
+
+    // free GL resources while the context still exists
+    assets.Clear();
+    cameraBuffer.release();
+    lightBuffer.release();
+    target.destroy();
+    context.destroy();
+    return result;
+}
+
+bool parseArguments(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cout << "usage: headless_benchmark [--frames N] [--warmup N] [--width W] [--height H] [--model path]"
+                " [--write out.ppm] [--compare reference.ppm] [--tolerance rmse]" << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if (argument == "--frames")
+            options.frames = std::max(std::atoi(value), 0);
+        else if (argument == "--warmup")
+            options.warmup = std::max(std::atoi(value), 0);
+        else if (argument == "--width")
+            options.width = std::max(std::atoi(value), 1);
+        else if (argument == "--height")
+            options.height = std::max(std::atoi(value), 1);
+        else if (argument == "--model")
+            options.modelPath = value;
+        else if (argument == "--write")
+            options.writePath = value;
+        else if (argument == "--compare")
+            options.comparePath = value;
+        else if (argument == "--tolerance")
+            options.tolerance = std::atof(value);
+        else
+        {
+            std::cout << "unknown option " << argument << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// figure eight in front of the chain, inside its reach of 1.5
+glm::vec3 scriptedTarget(float time)
+{
+    return glm::vec3(1.2f * cos(time), 0.8f * sin(2.0f * time), 0.4f * sin(time));
+}
+
+FrameStats summarize(std::vector<double> samples)
+{
+    FrameStats stats;
+    if (samples.empty())
+        return stats;
+    std::sort(samples.begin(), samples.end());
+    stats.min = samples.front();
+    stats.max = samples.back();
+    for (double sample : samples)
+        stats.mean += sample;
+    stats.mean /= samples.size();
+    stats.median = samples[samples.size() / 2];
+    stats.p95 = samples[std::min(samples.size() - 1, (size_t)(samples.size() * 0.95))];
+    return stats;
+}
+
+void printStats(const char* label, const FrameStats& stats)
+{
+    std::cout << label << " ms: min " << stats.min << "  mean " << stats.mean << "  median " << stats.median
+        << "  p95 " << stats.p95 << "  max " << stats.max << std::endl;
+}
+
+// RGB rows top to bottom, as image files store them
+std::vector<unsigned char> readFramebuffer(int width, int height)
+{
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    size_t rowSize = (size_t)width * 3;
+    std::vector<unsigned char> flipped(pixels.size());
+    for (int y = 0; y < height; y++)
+        std::memcpy(&flipped[(size_t)y * rowSize], &pixels[(size_t)(height - 1 - y) * rowSize], rowSize);
+    return flipped;
+}
+
+bool writePPM(const std::string& path, int width, int height, const std::vector<unsigned char>& rgb)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    return (bool)file;
+}
+
+// binary 8-bit PPM (P6) as written by writePPM, comment lines allowed in the header
+bool readPPM(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    auto nextToken = [&file]() -> std::string
+    {
+        std::string token;
+        while (file >> token && token[0] == '#')
+            std::getline(file, token);
+        return file ? token : std::string();
+    };
+    std::string magic = nextToken();
+    width = std::atoi(nextToken().c_str());
+    height = std::atoi(nextToken().c_str());
+    int maxValue = std::atoi(nextToken().c_str());
+    if (magic != "P6" || width <= 0 || height <= 0 || maxValue != 255)
+        return false;
+    file.get(); // single whitespace before the pixel data
+
+    rgb.resize((size_t)width * height * 3);
+    file.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+    return (size_t)file.gcount() == rgb.size();
+}
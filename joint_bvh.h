@@ -0,0 +1,336 @@
+#pragma once
+
+/* Bounding volume hierarchy over the bones of IK chains, for ray picking */
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "IKbone.h"
+
+// result of JointBVH::Pick; the picked bone runs from chains[chain]->joints[joint] towards the
+// next joint
+struct JointPick
+{
+	int chain = -1;
+	int joint = -1;
+	float distance = FLT_MAX; // along the ray
+	glm::vec3 point = glm::vec3(0.0f); // where the ray enters the bone's capsule
+
+	bool Hit() const { return joint >= 0; }
+};
+
+// Every joint is a capsule of the pick radius from IKJoint::position to
+// position + globalRotation * (boneLength, 0, 0), which is where the solver puts the next joint.
+// The capsules of all chains go into one tree. Build sorts them into it once. Refit is called
+// after the solver moved joints: it only recomputes the boxes above capsules that changed, and
+// builds the tree again when the refitted boxes got much looser than the built ones or a chain
+// gained or lost joints.
+//
+//   bvh.Build({ &solver.chain });
+//   solver.applyCCD(); bvh.Refit();
+//   JointPick pick = bvh.Pick(rayOrigin, rayDirection);
+class JointBVH
+{
+public:
+	explicit JointBVH(float radius = 0.08f)
+		: m_Radius(radius)
+	{
+	}
+
+	// the chains must outlive the tree or be passed to Build again
+	void Build(const std::vector<const IKChain*>& chains)
+	{
+		m_Chains = chains;
+		m_Bones.clear();
+		m_JointCounts.clear();
+		for (int c = 0; c < (int)m_Chains.size(); c++)
+		{
+			const std::vector<IKJoint>& joints = m_Chains[c]->joints;
+			m_JointCounts.push_back(joints.size());
+			for (int j = 0; j < (int)joints.size(); j++)
+			{
+				Bone bone;
+				bone.chain = c;
+				bone.joint = j;
+				UpdateCapsule(bone);
+				m_Bones.push_back(bone);
+			}
+		}
+
+		m_Nodes.clear();
+		m_Nodes.reserve(m_Bones.empty() ? 0 : 2 * m_Bones.size());
+		m_Depth = 0;
+		if (!m_Bones.empty())
+			BuildNode(0, (int)m_Bones.size(), 0);
+		m_BuiltArea = TotalArea();
+		m_BuildCount++;
+	}
+
+	// updates the tree to the chains' current joints
+	void Refit()
+	{
+		for (int c = 0; c < (int)m_Chains.size(); c++)
+		{
+			if (m_Chains[c]->joints.size() != m_JointCounts[c])
+			{
+				Build(m_Chains);
+				return;
+			}
+		}
+		if (m_Nodes.empty())
+			return;
+
+		// children always come after their parent, so going backwards visits them first
+		for (int i = (int)m_Nodes.size() - 1; i >= 0; i--)
+		{
+			Node& node = m_Nodes[i];
+			if (node.count > 0)
+			{
+				node.dirty = false;
+				for (int b = node.offset; b < node.offset + node.count; b++)
+					node.dirty |= UpdateCapsule(m_Bones[b]);
+				if (node.dirty)
+					LeafBounds(node);
+			}
+			else
+			{
+				const Node& left = m_Nodes[i + 1];
+				const Node& right = m_Nodes[node.offset];
+				node.dirty = left.dirty || right.dirty;
+				if (node.dirty)
+				{
+					node.min = glm::min(left.min, right.min);
+					node.max = glm::max(left.max, right.max);
+				}
+			}
+		}
+
+		// refitting keeps the tree's split, which stops fitting after large motions
+		if (m_Nodes[0].dirty && TotalArea() > REBUILD_AREA_RATIO * m_BuiltArea)
+			Build(m_Chains);
+	}
+
+	// nearest bone hit by the ray within maxDistance, see JointPick::Hit
+	JointPick Pick(const glm::vec3& origin, const glm::vec3& direction, float maxDistance = FLT_MAX) const
+	{
+		JointPick pick;
+		if (m_Nodes.empty() || glm::dot(direction, direction) == 0.0f)
+			return pick;
+
+		glm::vec3 dir = glm::normalize(direction);
+		glm::vec3 invDir = 1.0f / dir;
+		pick.distance = maxDistance;
+
+		// at most one pending sibling per level above the current node, plus its two children
+		std::vector<int> stack(m_Depth + 1);
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const Node& node = m_Nodes[stack[--stackSize]];
+			if (IntersectBox(origin, invDir, node.min, node.max) >= pick.distance)
+				continue;
+
+			if (node.count > 0)
+			{
+				for (int b = node.offset; b < node.offset + node.count; b++)
+				{
+					const Bone& bone = m_Bones[b];
+					float t = IntersectCapsule(origin, dir, bone.start, bone.end, m_Radius);
+					if (t >= 0.0f && t < pick.distance)
+					{
+						pick.distance = t;
+						pick.chain = bone.chain;
+						pick.joint = bone.joint;
+					}
+				}
+				continue;
+			}
+
+			// visit the nearer child first so the farther one is more likely to be skipped
+			int left = (int)(&node - m_Nodes.data()) + 1;
+			int right = node.offset;
+			float leftDistance = IntersectBox(origin, invDir, m_Nodes[left].min, m_Nodes[left].max);
+			float rightDistance = IntersectBox(origin, invDir, m_Nodes[right].min, m_Nodes[right].max);
+			if (leftDistance < rightDistance)
+				std::swap(left, right);
+			assert(stackSize + 2 <= (int)stack.size());
+			stack[stackSize++] = left;
+			stack[stackSize++] = right;
+		}
+
+		if (pick.Hit())
+			pick.point = origin + dir * pick.distance;
+		else
+			pick.distance = FLT_MAX;
+		return pick;
+	}
+
+	float Radius() const { return m_Radius; }
+	size_t BoneCount() const { return m_Bones.size(); }
+	size_t NodeCount() const { return m_Nodes.size(); }
+	// full builds so far, including the ones Refit fell back to
+	int BuildCount() const { return m_BuildCount; }
+
+private:
+	struct Bone
+	{
+		int chain;
+		int joint;
+		glm::vec3 start;
+		glm::vec3 end;
+	};
+
+	// a leaf (count > 0) holds m_Bones[offset, offset + count); an inner node's children are the
+	// next node and m_Nodes[offset]
+	struct Node
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		int offset = 0;
+		int count = 0;
+		bool dirty = false;
+	};
+
+	static const int MAX_LEAF_BONES = 4;
+	static constexpr float REBUILD_AREA_RATIO = 2.0f;
+
+	// returns true if the capsule moved
+	bool UpdateCapsule(Bone& bone) const
+	{
+		const IKJoint& joint = m_Chains[bone.chain]->joints[bone.joint];
+		glm::vec3 start = joint.position;
+		glm::vec3 end = joint.position + joint.globalRotation * glm::vec3(joint.boneLength, 0.0f, 0.0f);
+		bool moved = start != bone.start || end != bone.end;
+		bone.start = start;
+		bone.end = end;
+		return moved;
+	}
+
+	void LeafBounds(Node& node) const
+	{
+		node.min = glm::vec3(FLT_MAX);
+		node.max = glm::vec3(-FLT_MAX);
+		for (int b = node.offset; b < node.offset + node.count; b++)
+		{
+			node.min = glm::min(node.min, glm::min(m_Bones[b].start, m_Bones[b].end) - m_Radius);
+			node.max = glm::max(node.max, glm::max(m_Bones[b].start, m_Bones[b].end) + m_Radius);
+		}
+	}
+
+	// median split along the longest axis of the capsule centers
+	int BuildNode(int first, int count, int depth)
+	{
+		int index = (int)m_Nodes.size();
+		m_Nodes.emplace_back();
+		m_Depth = std::max(m_Depth, depth);
+
+		Node node;
+		node.offset = first;
+		node.count = count;
+		LeafBounds(node);
+
+		glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+		for (int b = first; b < first + count; b++)
+		{
+			glm::vec3 center = (m_Bones[b].start + m_Bones[b].end) * 0.5f;
+			centerMin = glm::min(centerMin, center);
+			centerMax = glm::max(centerMax, center);
+		}
+		glm::vec3 extent = centerMax - centerMin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		if (count > MAX_LEAF_BONES && extent[axis] > 0.0f)
+		{
+			int half = count / 2;
+			std::nth_element(m_Bones.begin() + first, m_Bones.begin() + first + half, m_Bones.begin() + first + count,
+				[axis](const Bone& a, const Bone& b) { return a.start[axis] + a.end[axis] < b.start[axis] + b.end[axis]; });
+			BuildNode(first, half, depth + 1);
+			node.offset = BuildNode(first + half, count - half, depth + 1);
+			node.count = 0;
+		}
+		m_Nodes[index] = node;
+		return index;
+	}
+
+	float TotalArea() const
+	{
+		float area = 0.0f;
+		for (const Node& node : m_Nodes)
+		{
+			glm::vec3 d = node.max - node.min;
+			area += d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+		return area;
+	}
+
+	// entry distance of the ray into the box (0 if it starts inside), FLT_MAX if it misses
+	static float IntersectBox(const glm::vec3& origin, const glm::vec3& invDir, const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 t0 = (min - origin) * invDir;
+		glm::vec3 t1 = (max - origin) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	// distance along the normalized dir to the capsule from a to b, -1 if it misses or the ray
+	// starts inside
+	static float IntersectCapsule(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& a, const glm::vec3& b, float radius)
+	{
+		glm::vec3 ba = b - a;
+		glm::vec3 oa = origin - a;
+		float baba = glm::dot(ba, ba);
+		float bard = glm::dot(ba, dir);
+		float baoa = glm::dot(ba, oa);
+
+		// the cylinder between the end caps
+		float k2 = baba - bard * bard;
+		if (baba > 0.0f && k2 > 1e-8f * baba)
+		{
+			float k1 = baba * glm::dot(oa, dir) - baoa * bard;
+			float k0 = baba * glm::dot(oa, oa) - baoa * baoa - radius * radius * baba;
+			float h = k1 * k1 - k2 * k0;
+			if (h < 0.0f)
+				return -1.0f; // misses the infinite cylinder, so the caps as well
+			float t = (-k1 - std::sqrt(h)) / k2;
+			float y = baoa + t * bard;
+			if (y > 0.0f && y < baba)
+				return t >= 0.0f ? t : -1.0f;
+		}
+
+		// the capsule is convex, so if the cylinder wasn't entered first an end cap was
+		float t = IntersectSphere(origin, dir, a, radius);
+		float tEnd = IntersectSphere(origin, dir, b, radius);
+		if (tEnd >= 0.0f && (t < 0.0f || tEnd < t))
+			t = tEnd;
+		return t;
+	}
+
+	static float IntersectSphere(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& center, float radius)
+	{
+		glm::vec3 oc = origin - center;
+		float b = glm::dot(oc, dir);
+		float h = b * b - (glm::dot(oc, oc) - radius * radius);
+		if (h < 0.0f)
+			return -1.0f;
+		float t = -b - std::sqrt(h);
+		return t >= 0.0f ? t : -1.0f;
+	}
+
+	float m_Radius;
+	std::vector<const IKChain*> m_Chains;
+	std::vector<size_t> m_JointCounts; // per chain at the last build
+	std::vector<Bone> m_Bones;         // in leaf order
+	std::vector<Node> m_Nodes;         // depth first, the root at 0
+	int m_Depth = 0;                   // of the deepest node, the root being 0
+	float m_BuiltArea = 0.0f;
+	int m_BuildCount = 0;
+};
@@ -12,10 +12,25 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "asset_manager.h"
+#include "uniform_buffer.h"
+#include "profiler.h"
+#include "fixed_timestep.h"
+#include "triple_buffer.h"
+#include "spsc_queue.h"
+#include "joint_bvh.h"
+#include "frustum.h"
 #include "IKbone.h"
 
 #include "stb_image.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -25,6 +40,13 @@ void processInput(GLFWwindow* window);
 float easeInOut(float t);
 void updateAnim(float currentTime);
 void triggerAnimation();
+void simulateStep(float dt, float time);
+void processInputEvents(double time);
+void cursorRay(float xpos, float ypos, glm::vec3& origin, glm::vec3& direction);
+glm::vec3 unprojectToPlane(float xpos, float ypos, float planeZ);
+float framebufferAspect();
+void renderLoop(GLFWwindow* window);
+void interpolateJoints(const std::vector<IKJoint>& previous, const std::vector<IKJoint>& current, float alpha, std::vector<IKJoint>& result);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -39,6 +61,8 @@ bool firstMouse = true;
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+// IK, spring and animation advance in fixed 1/120 s steps whatever the frame rate
+FixedTimestep simulationClock;
 
 struct DirLight {
     glm::vec3 direction;
@@ -59,9 +83,17 @@ glm::vec3 jointPos(0.5f, 0.0f, 0.0f);
 glm::vec3 joint2Pos(1.0f, 0.0f, 0.0f);
 glm::vec3 joint3Pos(1.5f, 0.0f, 0.0f);
 
+// bone picking: right-dragging a bone makes the grabbed point the solver's end effector and its
+// target follows the cursor at the bone's depth; right-dragging anywhere else puts the target of
+// the chain's tip on the z = 0 plane
+JointBVH jointBVH;
+JointPick grabbedJoint;
+bool rightDragging = false;
+
 // animation input
 bool animOn = false;
 bool springBone = false;
+bool spaceHeld = false; // Space toggles the animation once per press, not every frame it is down
 float startTime = 0.0f;
 float endTime;
 float totalDuration = 15.0f;
@@ -69,6 +101,39 @@ glm::vec3 startPosition = glm::vec3(0.636755, 0.986629, 0.000239521);
 glm::vec3 endPosition = glm::vec3(-0.343102, 0.572075, -0.000894032);
 bool isAnimationTriggered = false;
 
+// everything the render thread needs for one frame; the simulation thread fills a packet and
+// never touches it again once it is published
+struct FramePacket {
+    uint64_t frameIndex = 0;                // 0 until the first packet has been published
+    Camera camera;                          // for level of detail selection
+    CameraBlock cameraData;                 // projection, view and view position
+    std::vector<glm::mat4> jointTransforms; // interpolated joint poses as model matrices
+};
+
+// mouse input as recorded by the GLFW callbacks; the simulation drains it once per step
+struct InputEvent {
+    enum Type : uint8_t { CursorMove, Scroll };
+    Type type;
+    uint8_t buttons; // INPUT_BUTTON_* held when a CursorMove happened
+    double time;     // glfwGetTime() in the callback
+    double x, y;     // cursor position, or the scroll offsets
+};
+const uint8_t INPUT_BUTTON_LEFT = 1;
+const uint8_t INPUT_BUTTON_RIGHT = 2;
+
+// callbacks -> simulation; a full queue drops events, 1024 is several frames of a 8 kHz mouse
+SPSCQueue<InputEvent, 1024> inputEvents;
+
+// simulation -> render thread handoff
+TripleBuffer<FramePacket> framePackets;
+std::atomic<bool> renderRunning(true);
+// latest framebuffer size, from framebuffer_size_callback
+std::atomic<int> framebufferWidth(SCR_WIDTH);
+std::atomic<int> framebufferHeight(SCR_HEIGHT);
+// window size in screen coordinates, which cursor positions are in; main thread only
+int windowWidth = SCR_WIDTH;
+int windowHeight = SCR_HEIGHT;
+
 int main()
 {
     // glfw: initialize and configure
@@ -107,28 +172,31 @@ int main()
         return -1;
     }
 
-    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
-    stbi_set_flip_vertically_on_load(true);
+    // the render thread owns the context from here on
+    glfwMakeContextCurrent(NULL);
 
-    // configure global opengl state
-    // -----------------------------
-    glEnable(GL_DEPTH_TEST);
-
-    // build and compile shaders
-    // -------------------------
-    Shader modelShader("vertexShaders/IK_vs.txt", "fragmentShaders/IK_fs.txt");
+    // writes ik_profile.json when built with IK_ENABLE_PROFILER, see profiler.h
+    PROFILE_BEGIN_SESSION("ik_profile.json");
 
-    // load models
-    // -----------
-    Model boneModel("bone/newBone.obj");
+    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
+    stbi_set_flip_vertically_on_load(true);
 
     ikSolver.chain.addJoint(IKJoint(rootPos));
     ikSolver.chain.addJoint(IKJoint(jointPos));
     ikSolver.chain.addJoint(IKJoint(joint2Pos));
     ikSolver.chain.addJoint(IKJoint(joint3Pos));
+    jointBVH.Build({ &ikSolver.chain });
 
-    // render loop
-    // -----------
+    // chain pose before the last simulation step, and the pose drawn between it and the current one
+    std::vector<IKJoint> previousJoints = ikSolver.chain.joints;
+    std::vector<IKJoint> renderJoints = ikSolver.chain.joints;
+    uint64_t frameIndex = 0;
+
+    std::thread renderThread(renderLoop, window);
+
+    // simulation loop: events, input and IK stay on the main thread, which GLFW requires for
+    // event processing, and hand their result to the render thread as frame packets
+    // ---------------------------------------------------------------------------------------
     while (!glfwWindowShouldClose(window))
     {
         // per-frame time logic
@@ -139,81 +207,274 @@ int main()
 
         // input
         // -----
-        processInput(window);
-
-        // render
-        // ------
-        glClearColor(0.1f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // direct light settings
-        BasicLight.direction = glm::vec3(16.0f, -10.0f, -7.0f);
-        BasicLight.color = glm::vec3(1.0f);
-        BasicLight.ambient = glm::vec3(0.3f);
-        BasicLight.diffuse = glm::vec3(0.5f);
-        BasicLight.specular = glm::vec3(0.2f);
-
-        // update bone information
-        // -----------------------
-        ikSolver.setTarget(targetPos);
-        ikSolver.applyCCD();
+        {
+            PROFILE_CPU_SCOPE("Input");
+            glfwPollEvents();
+            processInput(window);
+        }
 
-        if (springBone) {
-            // counterclockwise, 30 degree
-            if (glm::distance(targetPos, glm::vec3(1.732f, 1.0f, 0.0f)) > 0.1f) {
-                targetPos += glm::vec3(1.0f, 1.0f, 1.0f) * 2.0f * deltaTime;
+        // update bone information in fixed steps
+        // --------------------------------------
+        {
+            PROFILE_CPU_SCOPE("Simulation");
+            int steps = simulationClock.Advance(deltaTime);
+            double now = glfwGetTime();
+            for (int step = 0; step < steps; step++) {
+                previousJoints = ikSolver.chain.joints;
+                double stepTime = simulationClock.Time() - (steps - 1 - step) * simulationClock.Step();
+                // each step takes the input of its own slice of real time, the last one everything left
+                double inputTime = step == steps - 1 ? DBL_MAX : now - (steps - 1 - step) * simulationClock.Step();
+                processInputEvents(inputTime);
+                simulateStep((float)simulationClock.Step(), (float)stepTime);
             }
         }
-        
-        if (animOn) {
-            updateAnim(currentFrame);
-            std::cout << "Ease-in ease-out animation on." << std::endl;
+        interpolateJoints(previousJoints, ikSolver.chain.joints, simulationClock.Alpha(), renderJoints);
+
+        // publish the frame; the packet's vectors keep their capacity, so this doesn't allocate
+        {
+            PROFILE_CPU_SCOPE("Publish");
+            FramePacket& packet = framePackets.WriteBuffer();
+            packet.frameIndex = ++frameIndex;
+            packet.camera = camera;
+            packet.cameraData.projection = glm::perspective(glm::radians(camera.Zoom), framebufferAspect(), 0.1f, 100.0f);
+            packet.cameraData.view = camera.GetViewMatrix();
+            packet.cameraData.viewPos = glm::vec4(camera.Position, 1.0f);
+
+            packet.jointTransforms.clear();
+            glm::mat4 modelMatrix = glm::mat4(1.0f);
+            for (const auto& joint : renderJoints) {
+                modelMatrix = glm::mat4(1.0f);
+
+                // joint global position
+                modelMatrix = glm::translate(modelMatrix, joint.position);
+
+                // joint global rotation
+                modelMatrix *= glm::toMat4(joint.globalRotation);
+
+                packet.jointTransforms.push_back(modelMatrix);
+            }
+            framePackets.Publish();
         }
-        
-        // draw the model
-        modelShader.use();
-
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-        modelShader.setVec3("diffuse_color", glm::vec3(1.0f, 1.0f, 0.8f));
-        modelShader.setVec3("specular_color", glm::vec3(1.0f));
+
+        // nothing new to simulate before the next step is due; the render thread is paced by the swap
+        std::this_thread::sleep_for(std::chrono::duration<double>((1.0 - simulationClock.Alpha()) * simulationClock.Step()));
+    }
+
+    renderRunning = false;
+    renderThread.join();
+
+    // glfw: terminate, clearing all previously allocated GLFW resources.
+    // ------------------------------------------------------------------
+    glfwTerminate();
+    return 0;
+}
+
+// render thread: makes the context current, creates every GL object and draws the newest frame
+// packet until the simulation thread clears renderRunning; GL objects are freed here as well
+void renderLoop(GLFWwindow* window)
+{
+    glfwMakeContextCurrent(window);
+    // wait for vertical sync on swap; this is what paces the render thread, otherwise it would
+    // redraw the same packet as fast as the GPU allows
+    glfwSwapInterval(1);
+
+    // configure global opengl state
+    // -----------------------------
+    glEnable(GL_DEPTH_TEST);
+
+    // build and compile shaders
+    // -------------------------
+    // the joints are instanced: the model matrix is a vertex attribute, not a uniform
+    Shader modelShader("vertexShaders/IK_instanced_vs.txt", "fragmentShaders/IK_fs.txt");
+
+    // camera and light are shared by every program through uniform buffers
+    // ---------------------------------------------------------------------
+    UniformBuffer<CameraBlock> cameraBuffer(CAMERA_BLOCK_BINDING);
+    UniformBuffer<LightBlock> lightBuffer(LIGHT_BLOCK_BINDING);
+    bool cameraBlock = modelShader.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+    bool lightBlock = modelShader.bindUniformBlock("Light", LIGHT_BLOCK_BINDING);
+    // a program with plain camera uniforms instead of the block gets them when the camera changes
+    UniformHandle<glm::mat4> projectionUniform = modelShader.getUniform<glm::mat4>("projection");
+    UniformHandle<glm::mat4> viewUniform = modelShader.getUniform<glm::mat4>("view");
+
+    // direct light settings, constant for the whole run
+    BasicLight.direction = glm::vec3(16.0f, -10.0f, -7.0f);
+    BasicLight.color = glm::vec3(1.0f);
+    BasicLight.ambient = glm::vec3(0.3f);
+    BasicLight.diffuse = glm::vec3(0.5f);
+    BasicLight.specular = glm::vec3(0.2f);
+    lightBuffer.update({ glm::vec4(BasicLight.direction, 0.0f), glm::vec4(BasicLight.color, 0.0f), glm::vec4(BasicLight.ambient, 0.0f),
+        glm::vec4(BasicLight.diffuse, 0.0f), glm::vec4(BasicLight.specular, 0.0f) });
+
+    // uniform values stay in the program, so the constant ones are only set once
+    modelShader.use();
+    modelShader.setVec3("diffuse_color", glm::vec3(1.0f, 1.0f, 0.8f));
+    modelShader.setVec3("specular_color", glm::vec3(1.0f));
+    if (!lightBlock) {
         modelShader.setVec3("dirLight.color", BasicLight.color);
         modelShader.setVec3("dirLight.direction", BasicLight.direction);
         modelShader.setVec3("dirLight.ambient", BasicLight.ambient);
         modelShader.setVec3("dirLight.diffuse", BasicLight.diffuse);
         modelShader.setVec3("dirLight.specular", BasicLight.specular);
+    }
 
-        glm::mat4 modelMatrix = glm::mat4(1.0f);
-        for (const auto& joint : ikSolver.chain.joints) {
-            modelMatrix = glm::mat4(1.0f);
+    // load models
+    // -----------
+    // models load in the background and show up as placeholder cubes until they are uploaded
+    ThreadPool importPool;
+    AssetManager assets(importPool);
+    ModelImportOptions importOptions;
+    importOptions.lodLevels = 4;
+    importOptions.releaseCPUData = true; // the joints are only drawn, never skinned or simplified on the CPU
+    ModelHandle boneModelHandle = assets.LoadModel("bone/newBone.obj", importOptions);
+
+    // joint transforms per LOD level (see Model::SelectLOD), then all levels back to back as
+    // uploaded to the instance buffer; kept outside the loop to reuse the allocations
+    std::vector<glm::mat4> jointInstances[4];
+    std::vector<glm::mat4> instanceTransforms;
+    // world bounding spheres of the joints and the ones left after frustum culling
+    SphereList jointBounds;
+    std::vector<uint32_t> visibleJoints;
+    int viewportWidth = SCR_WIDTH, viewportHeight = SCR_HEIGHT;
 
-            // joint global position
-            modelMatrix = glm::translate(modelMatrix, joint.position);
+    // render loop
+    // -----------
+    while (renderRunning)
+    {
+        // upload assets that finished loading
+        {
+            PROFILE_CPU_SCOPE("Asset uploads");
+            assets.Update();
+        }
 
-            // joint global rotation
-            modelMatrix *= glm::toMat4(joint.globalRotation);
+        // newest packet from the simulation thread, or the previous one again if none arrived
+        framePackets.Acquire();
+        const FramePacket& packet = framePackets.ReadBuffer();
 
-            modelShader.setMat4("model", modelMatrix);
-            boneModel.Draw(modelShader);
+        // the size callback runs on the main thread, which has no context
+        int width = framebufferWidth, height = framebufferHeight;
+        if (width != viewportWidth || height != viewportHeight) {
+            glViewport(0, 0, width, height);
+            viewportWidth = width;
+            viewportHeight = height;
         }
 
-        // check if it's time to stop the animation
-        if (isAnimationTriggered && currentFrame >= endTime) {
-            isAnimationTriggered = false;
+        // render
+        // ------
+        glClearColor(0.1f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        if (packet.frameIndex != 0) {
+            // draw the model
+            modelShader.use();
+
+            // uploaded only when the camera moved or zoomed
+            {
+                PROFILE_CPU_SCOPE("Uniform upload");
+                PROFILE_GPU_SCOPE("Uniform upload");
+                if (cameraBuffer.update(packet.cameraData) && !cameraBlock) {
+                    modelShader.set(projectionUniform, packet.cameraData.projection);
+                    modelShader.set(viewUniform, packet.cameraData.view);
+                }
+            }
+
+            {
+                PROFILE_CPU_SCOPE("Draw");
+                PROFILE_GPU_SCOPE("Draw");
+
+                Model& boneModel = assets.GetModel(boneModelHandle);
+
+                // joints whose bounding sphere is outside the view are not drawn
+                {
+                    PROFILE_CPU_SCOPE("Frustum culling");
+                    Frustum frustum = Frustum::FromMatrix(packet.cameraData.projection * packet.cameraData.view);
+                    jointBounds.Clear();
+                    for (const glm::mat4& modelMatrix : packet.jointTransforms) {
+                        glm::vec3 center;
+                        float radius;
+                        boneModel.GetWorldBounds(modelMatrix, center, radius);
+                        jointBounds.Add(center, radius);
+                    }
+                    CullSpheres(frustum, jointBounds, visibleJoints);
+                    PROFILE_COUNTER("Culled joints", jointBounds.Size() - visibleJoints.size());
+                }
+
+                for (auto& instances : jointInstances)
+                    instances.clear();
+                for (uint32_t joint : visibleJoints) {
+                    const glm::mat4& modelMatrix = packet.jointTransforms[joint];
+                    int lod = boneModel.SelectLOD(packet.camera, modelMatrix, (float)viewportHeight);
+                    jointInstances[lod].push_back(modelMatrix);
+                }
+
+                // one upload for every visible joint, then one draw per mesh and LOD level in use
+                instanceTransforms.clear();
+                for (const auto& instances : jointInstances)
+                    instanceTransforms.insert(instanceTransforms.end(), instances.begin(), instances.end());
+                boneModel.SetInstanceTransforms(instanceTransforms);
+                size_t firstInstance = 0;
+                for (int lod = 0; lod < 4; lod++) {
+                    boneModel.DrawInstanced(modelShader, firstInstance, jointInstances[lod].size(), lod);
+                    firstInstance += jointInstances[lod].size();
+                }
+                PROFILE_COUNTER("Joint instances", instanceTransforms.size());
+            }
         }
 
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // glfw: swap buffers
+        // ------------------
+        {
+            PROFILE_CPU_SCOPE("Swap");
+            glfwSwapBuffers(window);
+        }
+        PROFILE_FRAME_END();
     }
 
-    // glfw: terminate, clearing all previously allocated GLFW resources.
-    // ------------------------------------------------------------------
-    glfwTerminate();
-    return 0;
+    // free GL resources while the context is still current
+    PROFILE_END_SESSION();
+    assets.Clear();
+    cameraBuffer.release();
+    lightBuffer.release();
+    glfwMakeContextCurrent(NULL);
+}
+
+// one fixed simulation step of dt seconds ending at simulation time time
+void simulateStep(float dt, float time) {
+    {
+        PROFILE_CPU_SCOPE("IK solve");
+        ikSolver.setTarget(targetPos);
+        ikSolver.applyCCD();
+        jointBVH.Refit();
+    }
+
+    PROFILE_CPU_SCOPE("Animation");
+    if (springBone) {
+        // counterclockwise, 30 degree
+        if (glm::distance(targetPos, glm::vec3(1.732f, 1.0f, 0.0f)) > 0.1f) {
+            targetPos += glm::vec3(1.0f, 1.0f, 1.0f) * 2.0f * dt;
+        }
+    }
+
+    if (animOn) {
+        updateAnim(time);
+    }
+
+    // check if it's time to stop the animation
+    if (isAnimationTriggered && time >= endTime) {
+        isAnimationTriggered = false;
+    }
+}
+
+// pose alpha of the way from previous to current: positions are lerped, rotations slerped
+void interpolateJoints(const std::vector<IKJoint>& previous, const std::vector<IKJoint>& current, float alpha, std::vector<IKJoint>& result) {
+    result = current;
+    if (previous.size() != current.size())
+        return; // joints were added this step, nothing to interpolate from
+
+    for (size_t i = 0; i < current.size(); i++) {
+        result[i].position = glm::mix(previous[i].position, current[i].position, alpha);
+        result[i].globalRotation = glm::slerp(previous[i].globalRotation, current[i].globalRotation, alpha);
+    }
 }
 
 void updateAnim(float currentTime) {
@@ -241,7 +502,7 @@ void updateAnim(float currentTime) {
 
 void triggerAnimation() {
     if (!isAnimationTriggered) {
-        startTime = glfwGetTime();
+        startTime = (float)simulationClock.Time();
         endTime = startTime + totalDuration;
         isAnimationTriggered = true;
     }
@@ -264,6 +525,8 @@ void processInput(GLFWwindow* window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -273,15 +536,21 @@ void processInput(GLFWwindow* window)
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
 
+    bool wasAnimOn = animOn;
     if (glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS) {
         springBone = !springBone;
         animOn = false;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
+    bool spacePressed = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+    if (spacePressed && !spaceHeld) {
         animOn = !animOn;
         springBone = false;
     }
+    spaceHeld = spacePressed;
+
+    if (animOn != wasAnimOn)
+        std::cout << (animOn ? "Ease-in ease-out animation on." : "Ease-in ease-out animation off.") << std::endl;
 
 }
 
@@ -292,68 +561,162 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    // The render thread applies it, this thread has no context.
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
+// glfw: whenever the mouse moves, this callback is called; only records the event, see processInputEvents
+// -------------------------------------------------------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    // check if the left button of the mouse is pressed
+    uint8_t buttons = 0;
     if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+        buttons |= INPUT_BUTTON_LEFT;
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
+        buttons |= INPUT_BUTTON_RIGHT;
+    inputEvents.Push({ InputEvent::CursorMove, buttons, glfwGetTime(), xposIn, yposIn });
+}
+
+// drains the input events recorded up to time and applies them coalesced: camera rotation and
+// zoom are summed, a bone is picked where a right-drag started and the IK target is unprojected
+// once, from the last right-drag position
+void processInputEvents(double time)
+{
+    float xoffset = 0.0f, yoffset = 0.0f, scroll = 0.0f;
+    bool retarget = false, grab = false;
+    float targetX = 0.0f, targetY = 0.0f, grabX = 0.0f, grabY = 0.0f;
+
+    while (const InputEvent* event = inputEvents.Front())
     {
-        float xpos = static_cast<float>(xposIn);
-        float ypos = static_cast<float>(yposIn);
+        if (event->time > time)
+            break;
 
-        if (firstMouse)
+        float xpos = static_cast<float>(event->x);
+        float ypos = static_cast<float>(event->y);
+        if (event->type == InputEvent::Scroll) {
+            scroll += ypos;
+        }
+        // check if the left button of the mouse is pressed
+        else if (event->buttons & INPUT_BUTTON_LEFT)
         {
+            if (firstMouse)
+            {
+                lastX = xpos;
+                lastY = ypos;
+                firstMouse = false;
+            }
+
+            xoffset += xpos - lastX;
+            yoffset += lastY - ypos; // reversed since y-coordinates go from bottom to top
+
             lastX = xpos;
             lastY = ypos;
-            firstMouse = false;
         }
+        else if (event->buttons & INPUT_BUTTON_RIGHT) {
+            if (!rightDragging) {
+                grab = true;
+                grabX = xpos;
+                grabY = ypos;
+                rightDragging = true;
+            }
+            retarget = true;
+            targetX = xpos;
+            targetY = ypos;
+        }
+        else
+        {
+            firstMouse = true; // Reset the initial state if the mouse button is not pressed
+        }
+        if (!(event->buttons & INPUT_BUTTON_RIGHT) && event->type == InputEvent::CursorMove)
+            rightDragging = false;
+        inputEvents.PopFront();
+    }
 
-        float xoffset = xpos - lastX;
-        float yoffset = lastY - ypos; // reversed since y-coordinates go from bottom to top
-
-        lastX = xpos;
-        lastY = ypos;
-
+    if (xoffset != 0.0f || yoffset != 0.0f)
         camera.ProcessMouseMovement(xoffset, yoffset);
+    if (scroll != 0.0f)
+        camera.ProcessMouseScroll(scroll);
+
+    glm::vec3 origin, direction;
+    if (grab) {
+        PROFILE_CPU_SCOPE("Joint pick");
+        cursorRay(grabX, grabY, origin, direction);
+        grabbedJoint = jointBVH.Pick(origin, direction);
+        if (grabbedJoint.Hit()) {
+            // the point on the bone's axis closest to where the ray hit its capsule
+            const IKJoint& joint = ikSolver.chain.joints[grabbedJoint.joint];
+            glm::vec3 boneDirection = joint.globalRotation * glm::vec3(1.0f, 0.0f, 0.0f);
+            ikSolver.effectorJoint = grabbedJoint.joint;
+            ikSolver.effectorOffset = glm::clamp(glm::dot(grabbedJoint.point - joint.position, boneDirection), 0.0f, joint.boneLength);
+        }
+    }
+    if (!rightDragging && grabbedJoint.Hit()) {
+        // hand the target back to the chain's tip where it is now, so the chain doesn't jump
+        grabbedJoint = JointPick();
+        ikSolver.effectorJoint = -1;
+        targetPos = ikSolver.endEffectorPosition();
+    }
+
+    // Use the worldPos for target position in IK calculations
+    if (retarget) {
+        if (grabbedJoint.Hit()) {
+            cursorRay(targetX, targetY, origin, direction);
+            targetPos = origin + direction * grabbedJoint.distance;
+        }
+        else {
+            targetPos = unprojectToPlane(targetX, targetY, 0.0f);
+        }
     }
-    else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
-        // Convert screen position to normalized device coordinates
-        float xNDC = (2.0f * xposIn) / SCR_WIDTH - 1.0f;
-        float yNDC = 1.0f - (2.0f * yposIn) / SCR_HEIGHT;
+}
+
+// world space ray from the camera through the cursor, with a normalized direction
+void cursorRay(float xpos, float ypos, glm::vec3& origin, glm::vec3& direction)
+{
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), framebufferAspect(), 0.1f, 100.0f);
+    glm::mat4 view = camera.GetViewMatrix();
 
-        glm::vec4 clipCoords = glm::vec4(xNDC, yNDC, -1.0f, 1.0f);
+    // Convert screen position to normalized device coordinates
+    float xNDC = (2.0f * xpos) / std::max(windowWidth, 1) - 1.0f;
+    float yNDC = 1.0f - (2.0f * ypos) / std::max(windowHeight, 1);
 
-        // Convert clip coordinates to eye coordinates
-        glm::vec4 eyeCoords = glm::inverse(projection) * clipCoords;
-        eyeCoords = glm::vec4(eyeCoords.x, eyeCoords.y, -1.0f, 0.0f);
+    glm::vec4 clipCoords = glm::vec4(xNDC, yNDC, -1.0f, 1.0f);
 
-        // Convert eye coordinates to world coordinates
-        glm::vec4 worldCoords = glm::inverse(view) * eyeCoords;
+    // Convert clip coordinates to eye coordinates
+    glm::vec4 eyeCoords = glm::inverse(projection) * clipCoords;
+    eyeCoords = glm::vec4(eyeCoords.x, eyeCoords.y, -1.0f, 0.0f);
 
-        glm::vec3 rayWorld = glm::normalize(glm::vec3(worldCoords));
+    // Convert eye coordinates to world coordinates
+    glm::vec4 worldCoords = glm::inverse(view) * eyeCoords;
 
-        float planeZ = 0.0f;
+    origin = camera.Position;
+    direction = glm::normalize(glm::vec3(worldCoords));
+}
 
-        float t = (planeZ - camera.Position.z) / rayWorld.z;
-        glm::vec3 targetPosOnPlane = camera.Position + rayWorld * t;
+// width / height of the latest framebuffer size; a minimized window has a 0 x 0 framebuffer,
+// which keeps the initial aspect
+float framebufferAspect()
+{
+    int width = framebufferWidth, height = framebufferHeight;
+    if (width <= 0 || height <= 0)
+        return (float)SCR_WIDTH / (float)SCR_HEIGHT;
+    return (float)width / (float)height;
+}
 
-        // Use the worldPos for target position in IK calculations
-        targetPos = camera.Position + rayWorld * t;
-    }
-    else
-    {
-        firstMouse = true; // Reset the initial state if the mouse button is not pressed
-    }
+// world position under the cursor on the plane z = planeZ
+glm::vec3 unprojectToPlane(float xpos, float ypos, float planeZ)
+{
+    glm::vec3 origin, rayWorld;
+    cursorRay(xpos, ypos, origin, rayWorld);
+
+    float t = (planeZ - origin.z) / rayWorld.z;
+    return origin + rayWorld * t;
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    camera.ProcessMouseScroll(static_cast<float>(yoffset));
+    inputEvents.Push({ InputEvent::Scroll, 0, glfwGetTime(), xoffset, yoffset });
 }
 
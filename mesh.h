@@ -9,11 +9,21 @@
 
 #include "shader.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 using namespace std;
 
+// storage per vertex; build with MAX_BONE_INFLUENCE=8 to import up to 8 influences
+#ifndef MAX_BONE_INFLUENCE
 #define MAX_BONE_INFLUENCE 4
+#endif
+static_assert(MAX_BONE_INFLUENCE == 4 || MAX_BONE_INFLUENCE == 8, "bone influences are uploaded in groups of 4");
 
 struct Vertex {
     // position
@@ -32,6 +42,33 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// compact layout for skinned meshes (32 bytes with 4 influences, see vertex_packing.h)
+struct PackedVertex {
+    // position
+    glm::vec3 Position;
+    // octahedral-encoded normal, 2 x snorm16
+    uint32_t Normal;
+    // octahedral-encoded tangent in x/y (snorm10), bitangent sign in w (GL_INT_2_10_10_10_REV)
+    uint32_t Tangent;
+    // texCoords, 2 x half float
+    uint32_t TexCoords;
+    //bone indexes which will influence this vertex
+    uint8_t m_BoneIDs[MAX_BONE_INFLUENCE];
+    //weights from each bone, unorm8
+    uint8_t m_Weights[MAX_BONE_INFLUENCE];
+};
+
+enum class VertexFormat {
+    Full,
+    Packed
+};
+
+// range of the shared element buffer holding one level of detail (LOD 0 is the full mesh)
+struct MeshLOD {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+};
+
 struct Texture {
     unsigned int id;
     string type;
@@ -42,32 +79,210 @@ class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
+    vector<PackedVertex> packedVertices; // used instead of vertices when format is VertexFormat::Packed
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    VertexFormat         format = VertexFormat::Full;
+    vector<MeshLOD>      lods;
+    unsigned int VAO = 0;
+    // sizes of the uploaded buffers, still valid after ReleaseCPUData
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+
+    // object-space bounds of the vertex positions
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    glm::vec3 boundsCenter;
+    float     boundsRadius;
 
-    // constructor
+    // constructor; pass the arrays with std::move, the mesh keeps them as they are
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        setupSamplerNames();
+        this->lods = { { 0, static_cast<unsigned int>(this->indices.size()) } };
 
+        computeBounds();
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
+    // constructor for the compact vertex layout
+    Mesh(vector<PackedVertex> packedVertices, vector<unsigned int> indices, vector<Texture> textures)
+    {
+        this->packedVertices = std::move(packedVertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        setupSamplerNames();
+        this->format = VertexFormat::Packed;
+        this->lods = { { 0, static_cast<unsigned int>(this->indices.size()) } };
+
+        computeBounds();
+        setupMesh();
+    }
+
+    // constructor for geometry that is already in GPU layout in memory (e.g. a mapped mesh cache
+    // file): it is uploaded straight from vertexData/indexData, and only copied into the CPU
+    // arrays if keepCPUData is set
+    Mesh(VertexFormat format, const void* vertexData, size_t vertexCount, const unsigned int* indexData, size_t indexCount, vector<Texture> textures, bool keepCPUData = true)
+    {
+        this->format = format;
+        this->textures = std::move(textures);
+        setupSamplerNames();
+        this->lods = { { 0, static_cast<unsigned int>(indexCount) } };
+
+        size_t vertexStride = format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+        setupMesh(vertexData, vertexCount * vertexStride, indexData, indexCount);
+
+        if (format == VertexFormat::Packed)
+            computeBounds(static_cast<const PackedVertex*>(vertexData), vertexCount);
+        else
+            computeBounds(static_cast<const Vertex*>(vertexData), vertexCount);
+
+        if (keepCPUData)
+        {
+            if (format == VertexFormat::Packed)
+                packedVertices.assign(static_cast<const PackedVertex*>(vertexData), static_cast<const PackedVertex*>(vertexData) + vertexCount);
+            else
+                vertices.assign(static_cast<const Vertex*>(vertexData), static_cast<const Vertex*>(vertexData) + vertexCount);
+            indices.assign(indexData, indexData + indexCount);
+        }
+    }
+
+    // a mesh owns its GL objects, so it can be moved but not copied
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+
+    Mesh(Mesh&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    Mesh& operator=(Mesh&& other) noexcept
+    {
+        if (this != &other)
+        {
+            deleteBuffers();
+            vertices = std::move(other.vertices);
+            packedVertices = std::move(other.packedVertices);
+            indices = std::move(other.indices);
+            textures = std::move(other.textures);
+            samplerNames = std::move(other.samplerNames);
+            samplerLocations = std::move(other.samplerLocations);
+            samplerProgram = other.samplerProgram;
+            format = other.format;
+            lods = std::move(other.lods);
+            VAO = other.VAO;
+            VBO = other.VBO;
+            EBO = other.EBO;
+            vertexCount = other.vertexCount;
+            indexCount = other.indexCount;
+            boundsMin = other.boundsMin;
+            boundsMax = other.boundsMax;
+            boundsCenter = other.boundsCenter;
+            boundsRadius = other.boundsRadius;
+            other.VAO = other.VBO = other.EBO = 0;
+        }
+        return *this;
+    }
+
+    // needs the GL context that created the mesh to still be current
+    ~Mesh()
+    {
+        deleteBuffers();
+    }
+
+    // frees the CPU copies of the vertices and indices; drawing keeps working from the GPU
+    // buffers, but SetLODs, LOD building and CPU skinning need the arrays, so do those first
+    void ReleaseCPUData()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<PackedVertex>().swap(packedVertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    bool HasCPUData() const { return !indices.empty(); }
+
+    // replaces LODs 1..n with the given index lists; they share the vertex buffer and are
+    // appended to LOD 0 in a single element buffer
+    void SetLODs(const vector<vector<unsigned int>>& lodIndices)
+    {
+        assert(HasCPUData() || indexCount == 0);
+        vector<unsigned int> allIndices = indices;
+        lods.resize(1);
+        for (const auto& lod : lodIndices)
+        {
+            lods.push_back({ static_cast<unsigned int>(allIndices.size()), static_cast<unsigned int>(lod.size()) });
+            allIndices.insert(allIndices.end(), lod.begin(), lod.end());
+        }
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, allIndices.size() * sizeof(unsigned int), &allIndices[0], GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+
     // render the mesh
-    void Draw(Shader& shader)
+    void Draw(Shader& shader, int lod = 0)
+    {
+        bindTextures(shader);
+
+        // draw mesh
+        const MeshLOD& range = lods[std::min<size_t>(static_cast<size_t>(std::max(lod, 0)), lods.size() - 1)];
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (void*)(range.indexOffset * sizeof(unsigned int)));
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // render instanceCount copies in one call; instance i reads its model matrix from attribute
+    // locations 9-12 at matrix firstInstance + i of instanceBuffer (see Model::SetInstanceTransforms)
+    void DrawInstanced(Shader& shader, unsigned int instanceBuffer, size_t firstInstance, size_t instanceCount, int lod = 0)
+    {
+        if (instanceCount == 0)
+            return;
+
+        bindTextures(shader);
+
+        const MeshLOD& range = lods[std::min<size_t>(static_cast<size_t>(std::max(lod, 0)), lods.size() - 1)];
+        glBindVertexArray(VAO);
+        // the attribute offset is VAO state, so pointing it at firstInstance selects the range
+        // without needing base-instance draws (GL 4.2)
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(9 + column);
+            glVertexAttribPointer(9 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(firstInstance * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(9 + column, 1);
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (void*)(range.indexOffset * sizeof(unsigned int)), (GLsizei)instanceCount);
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    // render data 
+    unsigned int VBO = 0, EBO = 0;
+    // sampler uniform name per texture, and its location in the program that drew the mesh last
+    vector<string> samplerNames;
+    vector<GLint>  samplerLocations;
+    unsigned int   samplerProgram = 0;
+
+    // names the sampler of every texture once instead of on every draw
+    void setupSamplerNames()
     {
-        // bind appropriate textures
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
         unsigned int heightNr = 1;
+        samplerNames.clear();
         for (unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -79,28 +294,86 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to string
             else if (name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to string
+            samplerNames.push_back(name + number);
+        }
+        samplerLocations.clear();
+        samplerProgram = 0;
+    }
 
+    void bindTextures(Shader& shader)
+    {
+        if (samplerNames.size() != textures.size())
+            setupSamplerNames(); // textures was changed after construction
+        // locations only need resolving again when another program draws the mesh
+        if (samplerProgram != shader.ID || samplerLocations.size() != samplerNames.size())
+        {
+            samplerLocations.resize(samplerNames.size());
+            for (unsigned int i = 0; i < samplerNames.size(); i++)
+                samplerLocations[i] = shader.getUniformLocation(samplerNames[i]);
+            samplerProgram = shader.ID;
+        }
+
+        // bind appropriate textures
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+            glUniform1i(samplerLocations[i], i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    void deleteBuffers()
+    {
+        if (VAO)
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+        }
+        VAO = VBO = EBO = 0;
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    void computeBounds()
+    {
+        if (format == VertexFormat::Packed)
+            computeBounds(packedVertices.data(), packedVertices.size());
+        else
+            computeBounds(vertices.data(), vertices.size());
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
+    template <typename VertexT>
+    void computeBounds(const VertexT* data, size_t count)
+    {
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t i = 0; i < count; i++)
+        {
+            boundsMin = glm::min(boundsMin, data[i].Position);
+            boundsMax = glm::max(boundsMax, data[i].Position);
+        }
+        if (count == 0)
+            boundsMin = boundsMax = glm::vec3(0.0f);
+
+        // sphere around the box centre, tightened to the farthest actual vertex
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        float radiusSquared = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            radiusSquared = std::max(radiusSquared, glm::dot(data[i].Position - boundsCenter, data[i].Position - boundsCenter));
+        boundsRadius = sqrt(radiusSquared);
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
+    {
+        if (format == VertexFormat::Packed)
+            setupMesh(&packedVertices[0], packedVertices.size() * sizeof(PackedVertex), &indices[0], indices.size());
+        else
+            setupMesh(&vertices[0], vertices.size() * sizeof(Vertex), &indices[0], indices.size());
+    }
+
+    void setupMesh(const void* vertexData, size_t vertexBytes, const unsigned int* indexData, size_t indexCount)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
@@ -108,16 +381,27 @@ private:
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW);
+        this->vertexCount = vertexBytes / (format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex));
+        this->indexCount = indexCount;
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        if (format == VertexFormat::Packed)
+            setupPackedAttributes();
+        else
+            setupFullAttributes();
+        glBindVertexArray(0);
+    }
 
+    void setupFullAttributes()
+    {
         // set the vertex attribute pointers
         // vertex Positions
         glEnableVertexAttribArray(0);
@@ -134,14 +418,40 @@ private:
         // vertex bitangent
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        // ids
-        glEnableVertexAttribArray(5);
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
+        // ids and weights, 4 influences per attribute pair: (5, 6), then (7, 8) when MAX_BONE_INFLUENCE is 8
+        for (int group = 0; group * 4 < MAX_BONE_INFLUENCE; group++)
+        {
+            glEnableVertexAttribArray(5 + group * 2);
+            glVertexAttribIPointer(5 + group * 2, 4, GL_INT, sizeof(Vertex), (void*)(offsetof(Vertex, m_BoneIDs) + group * 4 * sizeof(int)));
+            glEnableVertexAttribArray(6 + group * 2);
+            glVertexAttribPointer(6 + group * 2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, m_Weights) + group * 4 * sizeof(float)));
+        }
+    }
 
-        // weights
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+    // same attribute locations as the full layout; shaders compiled with "PACKED_VERTEX"
+    // octahedral-decode location 1 and 3 and rebuild the bitangent as cross(normal, tangent.xyz) * tangent.w
+    void setupPackedAttributes()
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)0);
+        // vertex normals (octahedral)
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+        // vertex tangent (octahedral) + bitangent sign
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+        // ids and weights
+        for (int group = 0; group * 4 < MAX_BONE_INFLUENCE; group++)
+        {
+            glEnableVertexAttribArray(5 + group * 2);
+            glVertexAttribIPointer(5 + group * 2, 4, GL_UNSIGNED_BYTE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, m_BoneIDs) + group * 4));
+            glEnableVertexAttribArray(6 + group * 2);
+            glVertexAttribPointer(6 + group * 2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)(offsetof(PackedVertex, m_Weights) + group * 4));
+        }
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,277 @@
+#pragma once
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+// Binary cache of imported models. Vertices and indices are stored exactly as they are uploaded
+// to the GPU (Vertex or PackedVertex structs, 32-bit indices), each blob 16-byte aligned, so a
+// cache hit maps the file and hands the mapped pages to glBufferData without any parsing.
+//
+// layout: MeshCacheHeader | MeshCacheEntry[meshCount] | table | vertex/index blobs
+//   table: per bone (in id order) name + 16 floats offset matrix,
+//          then per mesh textureCount x (type, path) strings
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint32_t MESH_CACHE_VERSION = 1;
+const char MESH_CACHE_MAGIC[8] = "IKMESHC";
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertexFormat;
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    uint32_t boneCount;
+    uint32_t reserved;
+    uint64_t sourceHash; // key the file was written for, see Model::getCachePath
+    uint64_t tableOffset;
+    uint64_t tableSize;
+    uint64_t fileSize;
+};
+
+struct MeshCacheEntry {
+    uint64_t vertexOffset;
+    uint64_t vertexCount;
+    uint64_t indexOffset;
+    uint64_t indexCount;
+    uint32_t textureCount;
+    uint32_t reserved;
+};
+
+// FNV-1a, 64 bit; pass the previous result as hash to continue over several ranges
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_Mapping)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        m_Size = (size_t)size.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping keeps its own reference to the file
+        if (data == MAP_FAILED)
+            return false;
+        m_Data = static_cast<const char*>(data);
+        m_Size = (size_t)info.st_size;
+#endif
+        if (!m_Data)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_Data)
+            UnmapViewOfFile(m_Data);
+        if (m_Mapping)
+            CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE)
+            CloseHandle(m_File);
+        m_Mapping = nullptr;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data)
+            munmap(const_cast<char*>(m_Data), m_Size);
+#endif
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    const char* Data() const { return m_Data; }
+    size_t Size() const { return m_Size; }
+    bool IsOpen() const { return m_Data != nullptr; }
+
+private:
+    const char* m_Data = nullptr;
+    size_t m_Size = 0;
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = nullptr;
+#endif
+};
+
+// bounds-checked reads from the table section; ok turns false on the first read past the end
+struct MeshCacheReader {
+    const char* current;
+    const char* end;
+    bool ok = true;
+
+    MeshCacheReader(const char* begin, size_t size) : current(begin), end(begin + size) {}
+
+    template <typename T>
+    T Read()
+    {
+        T value{};
+        if (!ok || (size_t)(end - current) < sizeof(T))
+        {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, current, sizeof(T));
+        current += sizeof(T);
+        return value;
+    }
+
+    std::string ReadString()
+    {
+        uint32_t length = Read<uint32_t>();
+        if (!ok || (size_t)(end - current) < length)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string value(current, length);
+        current += length;
+        return value;
+    }
+};
+
+// builds a cache file in memory before it is written out in one go
+struct MeshCacheWriter {
+    std::vector<char> data;
+
+    void WriteBytes(const void* bytes, size_t size)
+    {
+        const char* source = static_cast<const char*>(bytes);
+        data.insert(data.end(), source, source + size);
+    }
+
+    template <typename T>
+    void Write(const T& value) { WriteBytes(&value, sizeof(T)); }
+
+    void WriteString(const std::string& value)
+    {
+        Write((uint32_t)value.size());
+        WriteBytes(value.data(), value.size());
+    }
+
+    // pads with zeros to the next multiple of alignment and returns the new offset
+    size_t Align(size_t alignment)
+    {
+        data.resize((data.size() + alignment - 1) / alignment * alignment, 0);
+        return data.size();
+    }
+
+    template <typename T>
+    void Patch(size_t offset, const T& value) { std::memcpy(&data[offset], &value, sizeof(T)); }
+
+    // writes to a temporary file first so an interrupted write never leaves a truncated cache behind
+    bool Save(const std::string& path) const
+    {
+        std::string temporaryPath = path + ".tmp";
+        FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+        if (!file)
+            return false;
+        bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+        written = std::fclose(file) == 0 && written;
+        if (!written)
+        {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        std::remove(path.c_str()); // rename does not replace an existing file on Windows
+        return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+    }
+};
+
+// true if the mapped file is a complete cache written for sourceHash with the given vertex layout.
+// Every index is checked against its mesh's vertex count as well, so a damaged file can't send
+// out-of-range indices to the simplifier or to glDrawElements.
+inline bool ValidateMeshCache(const MappedFile& file, uint64_t sourceHash, uint32_t vertexFormat, uint32_t vertexStride)
+{
+    if (file.Size() < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    std::memcpy(&header, file.Data(), sizeof(header));
+    if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != MESH_CACHE_VERSION
+        || header.sourceHash != sourceHash || header.vertexFormat != vertexFormat || header.vertexStride != vertexStride
+        || header.fileSize != file.Size())
+        return false;
+
+    uint64_t entriesEnd = sizeof(MeshCacheHeader) + (uint64_t)header.meshCount * sizeof(MeshCacheEntry);
+    if (entriesEnd > file.Size() || header.tableOffset < entriesEnd || header.tableSize > file.Size() - header.tableOffset)
+        return false;
+
+    const MeshCacheEntry* entries = reinterpret_cast<const MeshCacheEntry*>(file.Data() + sizeof(MeshCacheHeader));
+    for (uint32_t i = 0; i < header.meshCount; i++)
+    {
+        const MeshCacheEntry& entry = entries[i];
+        if (entry.vertexOffset % 16 != 0 || entry.indexOffset % 16 != 0
+            || entry.vertexOffset > file.Size() || entry.vertexCount > (file.Size() - entry.vertexOffset) / vertexStride
+            || entry.indexOffset > file.Size() || entry.indexCount > (file.Size() - entry.indexOffset) / sizeof(uint32_t))
+            return false;
+
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(file.Data() + entry.indexOffset);
+        uint32_t maxIndex = 0;
+        for (uint64_t j = 0; j < entry.indexCount; j++)
+        {
+            if (indices[j] > maxIndex)
+                maxIndex = indices[j];
+        }
+        if (entry.indexCount > 0 && maxIndex >= entry.vertexCount)
+            return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,286 @@
+#pragma once
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+// Quadric error metric simplification (Garland & Heckbert 1997) for building mesh LODs.
+// Edges are collapsed onto one of their existing vertices, so every vertex that survives keeps
+// its exact UVs, normals and bone weights and the vertex buffer can be shared by all LODs.
+// Vertices on UV/normal seams (same position, different attributes) and on open borders are
+// locked, and a collapse is only allowed between vertices driven by the same dominant bone.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+
+    // quadric of the plane n.p + d = 0, scaled by weight
+    static Quadric FromPlane(const glm::dvec3& n, double d, double weight)
+    {
+        Quadric q;
+        q.a00 = n.x * n.x * weight; q.a01 = n.x * n.y * weight; q.a02 = n.x * n.z * weight; q.a03 = n.x * d * weight;
+        q.a11 = n.y * n.y * weight; q.a12 = n.y * n.z * weight; q.a13 = n.y * d * weight;
+        q.a22 = n.z * n.z * weight; q.a23 = n.z * d * weight;
+        q.a33 = d * d * weight;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& o)
+    {
+        a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+        a11 += o.a11; a12 += o.a12; a13 += o.a13;
+        a22 += o.a22; a23 += o.a23;
+        a33 += o.a33;
+        return *this;
+    }
+
+    // sum of squared distances of p to the accumulated planes
+    double Evaluate(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+            + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+            + a22 * z * z + 2 * a23 * z
+            + a33;
+    }
+};
+
+namespace detail {
+
+template <typename VertexT>
+int DominantBone(const VertexT& vertex)
+{
+    int best = 0;
+    for (int i = 1; i < MAX_BONE_INFLUENCE; i++)
+    {
+        if (vertex.m_Weights[i] > vertex.m_Weights[best])
+            best = i;
+    }
+    return vertex.m_Weights[best] > 0 ? (int)vertex.m_BoneIDs[best] : -1;
+}
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const
+    {
+        // -0.0f == 0.0f, so both must hash alike
+        glm::vec3 key(p.x == 0.0f ? 0.0f : p.x, p.y == 0.0f ? 0.0f : p.y, p.z == 0.0f ? 0.0f : p.z);
+        unsigned int h[3];
+        std::memcpy(h, &key, sizeof(h));
+        return (size_t)(h[0] * 73856093u ^ h[1] * 19349663u ^ h[2] * 83492791u);
+    }
+};
+
+} // namespace detail
+
+// returns a new index list over the same vertices with at most targetIndexCount indices, or
+// fewer reduction if that would exceed maxError (a distance in model units)
+template <typename VertexT>
+std::vector<unsigned int> SimplifyMesh(const VertexT* vertices, size_t vertexCount, const std::vector<unsigned int>& indices,
+    size_t targetIndexCount, float maxError = FLT_MAX)
+{
+    std::vector<unsigned int> result = indices;
+    if (vertexCount == 0 || indices.size() <= targetIndexCount)
+        return result;
+
+    // lock seam vertices: more than one vertex at the same position with different attributes
+    std::vector<bool> locked(vertexCount, false);
+    std::unordered_map<glm::vec3, unsigned int, detail::PositionHash> firstAtPosition;
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        auto inserted = firstAtPosition.emplace(vertices[v].Position, (unsigned int)v);
+        if (!inserted.second && std::memcmp(&vertices[v], &vertices[inserted.first->second], sizeof(VertexT)) != 0)
+        {
+            locked[v] = true;
+            locked[inserted.first->second] = true;
+        }
+    }
+
+    // lock border vertices: edges used by a single triangle
+    std::unordered_map<unsigned long long, int> edgeUse;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned long long a = indices[i + k], b = indices[i + (k + 1) % 3];
+            edgeUse[std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    }
+    for (const auto& edge : edgeUse)
+    {
+        if (edge.second == 1)
+        {
+            locked[edge.first >> 32] = true;
+            locked[edge.first & 0xffffffffull] = true;
+        }
+    }
+
+    // area-weighted plane quadrics per vertex
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        glm::dvec3 p0(vertices[indices[i]].Position), p1(vertices[indices[i + 1]].Position), p2(vertices[indices[i + 2]].Position);
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double area = glm::length(normal);
+        if (area <= 0.0)
+            continue;
+        normal /= area;
+        Quadric q = Quadric::FromPlane(normal, -glm::dot(normal, p0), area * 0.5);
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[i + k]] += q;
+    }
+
+    std::vector<int> dominantBone(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        dominantBone[v] = detail::DominantBone(vertices[v]);
+
+    double maxCost = maxError >= FLT_MAX ? DBL_MAX : (double)maxError * (double)maxError;
+
+    struct Collapse {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<unsigned int> offsets(vertexCount + 1), adjacency, fill;
+
+    // each pass collapses the cheapest independent edges, then rebuilds the index list
+    while (result.size() > targetIndexCount)
+    {
+        size_t triangleCount = result.size() / 3;
+
+        // vertex -> triangle adjacency
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (unsigned int index : result)
+            offsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(result.size());
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[result[t * 3 + k]]++] = (unsigned int)t;
+
+        collapses.clear();
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = result[t * 3 + k], b = result[t * 3 + (k + 1) % 3];
+                if (dominantBone[a] != dominantBone[b])
+                    continue;
+
+                Quadric q = quadrics[a];
+                q += quadrics[b];
+                if (!locked[a])
+                    collapses.push_back({ a, b, q.Evaluate(vertices[b].Position) });
+                if (!locked[b])
+                    collapses.push_back({ b, a, q.Evaluate(vertices[a].Position) });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        for (size_t v = 0; v < vertexCount; v++)
+            remap[v] = (unsigned int)v;
+        std::fill(touched.begin(), touched.end(), false);
+
+        size_t removedTriangles = 0;
+        size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+        for (const Collapse& collapse : collapses)
+        {
+            if (removedTriangles >= trianglesToRemove || collapse.cost > maxCost)
+                break;
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // reject collapses that would flip a triangle around the removed vertex
+            const glm::vec3& target = vertices[collapse.to].Position;
+            bool flips = false;
+            size_t removed = 0;
+            for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1] && !flips; a++)
+            {
+                const unsigned int* tri = &result[adjacency[a] * 3];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+                {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 p[3], moved[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = vertices[tri[k]].Position;
+                    moved[k] = tri[k] == collapse.from ? target : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            removedTriangles += removed;
+
+            // the neighbourhood of the removed vertex changed, keep it out of this pass
+            for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++)
+                for (int k = 0; k < 3; k++)
+                    touched[result[adjacency[a] * 3 + k]] = true;
+        }
+
+        if (removedTriangles == 0)
+            break; // nothing left that can be collapsed within the constraints
+
+        std::vector<unsigned int> next;
+        next.reserve(result.size());
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            unsigned int a = remap[result[t * 3]], b = remap[result[t * 3 + 1]], c = remap[result[t * 3 + 2]];
+            if (a != b && b != c && a != c)
+            {
+                next.push_back(a);
+                next.push_back(b);
+                next.push_back(c);
+            }
+        }
+        result.swap(next);
+    }
+
+    return result;
+}
+
+template <typename VertexT>
+std::vector<unsigned int> SimplifyMesh(const std::vector<VertexT>& vertices, const std::vector<unsigned int>& indices,
+    size_t targetIndexCount, float maxError = FLT_MAX)
+{
+    return SimplifyMesh(vertices.data(), vertices.size(), indices, targetIndexCount, maxError);
+}
+
+// index lists for levels 1..levelCount-1, each simplified from the previous level down to
+// `reduction` of its triangles
+template <typename VertexT>
+std::vector<std::vector<unsigned int>> SimplifyMeshLODs(const VertexT* vertices, size_t vertexCount,
+    const std::vector<unsigned int>& indices, int levelCount, float reduction)
+{
+    std::vector<std::vector<unsigned int>> lodIndices;
+    if (levelCount > 1)
+        lodIndices.reserve(levelCount - 1);
+    for (int level = 1; level < levelCount; level++)
+    {
+        const std::vector<unsigned int>& previous = level == 1 ? indices : lodIndices.back();
+        size_t target = static_cast<size_t>(previous.size() * reduction) / 3 * 3;
+        lodIndices.push_back(SimplifyMesh(vertices, vertexCount, previous, target));
+    }
+    return lodIndices;
+}
+
+#endif
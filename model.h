@@ -11,86 +11,625 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "camera.h"
 #include "shader.h"
+#include "vertex_packing.h"
+#include "thread_pool.h"
+#include "texture_cache.h"
+#include "uniform_buffer.h"
+#include "profiler.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include "assimp_glm_helpers.h"
 #include "animdata.h"
+#include "bone_names.h"
 
 using namespace std;
 
+struct ModelImportOptions
+{
+	// layout the meshes are stored in (see vertex_packing.h for VertexFormat::Packed)
+	VertexFormat vertexFormat = VertexFormat::Full;
+	// K: only the K heaviest influences per vertex are kept and renormalized (4 or 8, at most MAX_BONE_INFLUENCE)
+	int boneInfluences = MAX_BONE_INFLUENCE;
+	// deduplicate vertices and reorder triangles/vertices for cache locality (see mesh_optimizer.h)
+	bool optimizeMeshes = false;
+	// directory for binary mesh caches (see mesh_cache.h); empty disables caching. The cache is keyed on
+	// the model file's contents and the options above, so edits to .mtl files or textures are not detected.
+	string cacheDirectory;
+	// workers for mesh conversion and image decoding (not owned); without a pool every stage runs serially
+	ThreadPool* threadPool = nullptr;
+	// levels of detail simplified during import (1 = full detail only), see Model::BuildLODs
+	int lodLevels = 1;
+	float lodReduction = 0.5f;
+	// Model::SelectLOD picks LOD i for the first i whose on-screen radius in pixels the model's
+	// bounding sphere reaches, and LOD 3 below all of them
+	float lodScreenRadii[3] = { 80.0f, 40.0f, 20.0f };
+	// free each mesh's CPU vertex and index arrays once they are on the GPU. LODs from lodLevels are
+	// built before that; Model::BuildLODs, CPU skinning and the mesh optimizer need the arrays.
+	bool releaseCPUData = false;
+};
+
+// compiles the skinning shader variant for the influence count and vertex format a model was imported with;
+// pass the model's importOptions once it is loaded, Import may have changed its vertexFormat
+inline Shader LoadSkinningShader(const ModelImportOptions& options, const char* fragmentPath)
+{
+	int influences = options.boneInfluences <= 4 ? 4 : 8;
+	std::vector<std::string> defines = { "MAX_BONE_INFLUENCE " + std::to_string(influences) };
+	if (options.vertexFormat == VertexFormat::Packed)
+		defines.push_back("PACKED_VERTEX");
+	Shader shader("vertexShaders/skinning_vs.txt", fragmentPath, nullptr, defines);
+	shader.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+	shader.bindUniformBlock("Light", LIGHT_BLOCK_BINDING); // if the fragment shader uses the shared light
+	return shader;
+}
+
+// pixels decoded by stb_image, waiting to be uploaded
+struct DecodedImage
+{
+	string path;
+	string type;
+	string directory;
+	unsigned char* data = nullptr;
+	int width = 0, height = 0, nrComponents = 0;
+};
+
+// reads and decodes directory/path; safe to call from worker threads
+inline void DecodeImage(DecodedImage& image)
+{
+	string filename = image.directory + '/' + image.path;
+	image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+}
+
+// creates the GL texture and frees the decoded pixels; context thread only
+inline unsigned int UploadTexture(DecodedImage& image)
+{
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+
+	if (image.data)
+	{
+		GLenum format;
+		if (image.nrComponents == 1)
+			format = GL_RED;
+		else if (image.nrComponents == 3)
+			format = GL_RGB;
+		else if (image.nrComponents == 4)
+			format = GL_RGBA;
+
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		stbi_image_free(image.data);
+		image.data = nullptr;
+	}
+	else
+	{
+		std::cout << "Texture failed to load at path: " << image.path << std::endl;
+	}
+
+	return textureID;
+}
+
 class Model
 {
 public:
 	// model data 
-	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	vector<Texture> textures_loaded;	// every texture this model holds a TextureCache reference to, once each
 	vector<Mesh>    meshes;
 	string directory;
 	bool gammaCorrection;
+	ModelImportOptions importOptions;
+	// object-space bounding sphere of all meshes
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
 
 
 
 	// constructor, expects a filepath to a 3D model.
-	Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const& path, bool gamma = false, const ModelImportOptions& options = ModelImportOptions()) : gammaCorrection(gamma), importOptions(options)
+	{
+		assert(importOptions.boneInfluences >= 1 && importOptions.boneInfluences <= MAX_BONE_INFLUENCE);
+		if (Import(path))
+			Upload();
+	}
+
+	// empty model for two-phase loading (see asset_manager.h)
+	explicit Model(const ModelImportOptions& options, bool gamma = false) : gammaCorrection(gamma), importOptions(options)
+	{
+		assert(importOptions.boneInfluences >= 1 && importOptions.boneInfluences <= MAX_BONE_INFLUENCE);
+	}
+
+	// textures are shared through the global TextureCache and released by the destructor, so a
+	// copy would release them twice
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+
+	~Model()
 	{
-		loadModel(path);
+		for (const auto& texture : m_TextureIds)
+			TextureCache::Get().Release(texture.first);
+		if (m_InstanceBuffer)
+			glDeleteBuffers(1, &m_InstanceBuffer);
+	}
+
+	// reads the model (from the mesh cache or through Assimp) and does all CPU-side processing. Touches
+	// no GL state, so it may run on a worker thread; Upload then has to run on the context thread.
+	bool Import(string const& path)
+	{
+		PROFILE_CPU_SCOPE("Model import");
+		m_Pending.reset(new PendingImport());
+		m_Pending->path = path;
+
+		// retrieve the directory path of the filepath
+		directory = path.substr(0, path.find_last_of('/'));
+
+		// a valid cache skips Assimp entirely
+		string cachePath;
+		if (!importOptions.cacheDirectory.empty())
+		{
+			cachePath = getCachePath(path);
+			if (!cachePath.empty() && importFromCache(cachePath))
+			{
+				runImportJobs(nullptr);
+				return true;
+			}
+		}
+
+		// read file via ASSIMP
+		Assimp::Importer importer;
+		const aiScene* scene;
+		{
+			PROFILE_CPU_SCOPE("Assimp read");
+			scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+		}
+		// check for errors
+		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		{
+			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			m_Pending.reset();
+			return false;
+		}
+
+		// stage 1 (serial): gather meshes, bones and texture paths. Bone ids are handed out here
+		// in mesh order, so they don't depend on how the later stages are scheduled.
+		vector<aiMesh*> sceneMeshes;
+		{
+			PROFILE_CPU_SCOPE("Gather");
+			processNode(scene->mRootNode, scene, sceneMeshes);
+			m_Pending->meshes.resize(sceneMeshes.size());
+			for (size_t i = 0; i < sceneMeshes.size(); i++)
+			{
+				RegisterBones(sceneMeshes[i]);
+				collectMaterialTextures(scene->mMaterials[sceneMeshes[i]->mMaterialIndex], m_Pending->meshes[i]);
+			}
+		}
+		if (importOptions.vertexFormat == VertexFormat::Packed && m_BoneCounter > MAX_PACKED_BONES)
+		{
+			cout << "ERROR::MODEL:: " << path << " has " << m_BoneCounter << " bones, more than packed vertices can address ("
+				<< MAX_PACKED_BONES << "); importing it with VertexFormat::Full" << endl;
+			importOptions.vertexFormat = VertexFormat::Full;
+		}
+
+		// stage 2 (parallel): convert meshes and decode images
+		runImportJobs(&sceneMeshes);
+
+		if (!cachePath.empty())
+			writeCache(cachePath);
+		return true;
+	}
+
+	// stage 3: creates the GL textures and meshes for the last Import in one batch
+	void Upload()
+	{
+		if (!m_Pending)
+			return;
+
+		PROFILE_CPU_SCOPE("Model upload");
+		meshes.reserve(meshes.size() + m_Pending->meshes.size());
+		for (ImportedMesh& imported : m_Pending->meshes)
+			uploadMesh(imported);
+		computeBounds();
+
+		m_Pending.reset(); // also unmaps the cache file
 	}
 
 	// draws the model, and thus all its meshes
-	void Draw(Shader& shader)
+	void Draw(Shader& shader, int lod = 0)
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shader);
+			meshes[i].Draw(shader, lod);
+	}
+
+	// uploads one model matrix per instance for DrawInstanced, replacing the previous set
+	void SetInstanceTransforms(const vector<glm::mat4>& transforms)
+	{
+		if (!m_InstanceBuffer)
+			glGenBuffers(1, &m_InstanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_InstanceBuffer);
+
+		// the buffer is orphaned on every upload so the driver doesn't wait for last frame's draws
+		m_InstanceCapacity = std::max(m_InstanceCapacity, transforms.size());
+		glBufferData(GL_ARRAY_BUFFER, m_InstanceCapacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+		if (!transforms.empty())
+			glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+		m_InstanceCount = transforms.size();
+	}
+
+	// draws instances [first, first + count) of the last SetInstanceTransforms with one draw call
+	// per mesh; the shader takes the model matrix from attribute locations 9-12
+	// (vertexShaders/IK_instanced_vs.txt)
+	void DrawInstanced(Shader& shader, size_t first, size_t count, int lod = 0)
+	{
+		assert(first + count <= m_InstanceCount);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawInstanced(shader, m_InstanceBuffer, first, count, lod);
+	}
+
+	// builds levelCount - 1 simplified index buffers per mesh, each level reduced to `reduction` of
+	// the previous one's triangles (see mesh_simplifier.h). ModelImportOptions::lodLevels does the
+	// same during Import, off the context thread.
+	void BuildLODs(int levelCount = 4, float reduction = 0.5f)
+	{
+		for (Mesh& mesh : meshes)
+		{
+			if (!mesh.HasCPUData())
+			{
+				cout << "ERROR::MODEL:: BuildLODs needs CPU mesh data, import with lodLevels instead of releaseCPUData" << endl;
+				return;
+			}
+			if (mesh.format == VertexFormat::Packed)
+				mesh.SetLODs(SimplifyMeshLODs(mesh.packedVertices.data(), mesh.packedVertices.size(), mesh.indices, levelCount, reduction));
+			else
+				mesh.SetLODs(SimplifyMeshLODs(mesh.vertices.data(), mesh.vertices.size(), mesh.indices, levelCount, reduction));
+		}
+	}
+
+	// the bounding sphere of all meshes placed by modelMatrix; the radius grows with the largest axis scale
+	void GetWorldBounds(const glm::mat4& modelMatrix, glm::vec3& center, float& radius) const
+	{
+		center = glm::vec3(modelMatrix * glm::vec4(boundsCenter, 1.0f));
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+		radius = boundsRadius * scale;
+	}
+
+	// picks a level of detail from the on-screen size of the model's bounding sphere
+	int SelectLOD(const Camera& camera, const glm::mat4& modelMatrix, float viewportHeight) const
+	{
+		glm::vec3 center;
+		float radius;
+		GetWorldBounds(modelMatrix, center, radius);
+		float projectedRadius = camera.GetProjectedRadius(center, radius, viewportHeight);
+
+		const int thresholdCount = sizeof(importOptions.lodScreenRadii) / sizeof(importOptions.lodScreenRadii[0]);
+		for (int lod = 0; lod < thresholdCount; lod++)
+		{
+			if (projectedRadius >= importOptions.lodScreenRadii[lod])
+				return lod;
+		}
+		return thresholdCount; // Mesh::Draw clamps to the LODs that exist
 	}
 
 	auto& GetBoneInfoMap() { return m_BoneInfoMap; }
 	int& GetBoneCount() { return m_BoneCounter; }
+	BoneNameTable& GetBoneNames() { return m_BoneNames; }
 
 
 private:
 
 	std::map<string, BoneInfo> m_BoneInfoMap;
 	int m_BoneCounter = 0;
+	BoneNameTable m_BoneNames; // bone handle == BoneInfo::id
+	uint64_t m_CacheKey = 0;
+	unordered_map<string, unsigned int> m_TextureIds; // canonical path -> id this model holds a reference to
+	unsigned int m_InstanceBuffer = 0;
+	size_t m_InstanceCapacity = 0; // in matrices
+	size_t m_InstanceCount = 0;
+
+	// CPU-side result of converting one aiMesh, or of reading it from the cache; becomes a Mesh on Upload
+	struct ImportedMesh
+	{
+		string name;
+		vector<Vertex> vertices;
+		vector<PackedVertex> packedVertices;
+		vector<unsigned int> indices;
+		// set instead of the arrays above when the data is read straight from PendingImport::cacheFile
+		const void* mappedVertices = nullptr;
+		size_t mappedVertexCount = 0;
+		const unsigned int* mappedIndices = nullptr;
+		size_t mappedIndexCount = 0;
+		vector<vector<unsigned int>> lodIndices;
+		vector<pair<string, string>> textures; // (type, path)
+		MeshOptimizationStats stats;
+	};
+
+	// everything Import hands over to Upload
+	struct PendingImport
+	{
+		string path;
+		vector<ImportedMesh> meshes;
+		vector<DecodedImage> images;
+		unordered_map<string, size_t> imageIndex; // canonical path -> index into images
+		MappedFile cacheFile; // keeps the mapped vertex/index data alive until it is uploaded
+
+		// frees images that were never uploaded, e.g. because another model uploaded them first
+		~PendingImport()
+		{
+			for (DecodedImage& image : images)
+				stbi_image_free(image.data);
+		}
+	};
+	unique_ptr<PendingImport> m_Pending;
 
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const& path)
+	// stage 2: converts the given scene meshes (none for a cache hit), builds LODs and decodes images,
+	// spread over the import thread pool if there is one. With the profiler on, every job is a zone
+	// on the thread that ran it, so serial and pooled imports can be compared in one trace.
+	void runImportJobs(const vector<aiMesh*>* sceneMeshes)
 	{
-		// read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
-		// check for errors
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		PROFILE_CPU_SCOPE("Convert and decode");
+		vector<ImportedMesh>& imported = m_Pending->meshes;
+		vector<DecodedImage>& images = m_Pending->images;
+		auto convert = [&](size_t begin, size_t end)
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			for (size_t job = begin; job < end; job++)
+			{
+				if (job < imported.size())
+				{
+					PROFILE_CPU_SCOPE("Convert mesh");
+					if (sceneMeshes)
+						processMesh((*sceneMeshes)[job], imported[job]);
+					buildLODIndices(imported[job]);
+				}
+				else
+				{
+					PROFILE_CPU_SCOPE("Decode image");
+					DecodeImage(images[job - imported.size()]);
+				}
+			}
+		};
+		size_t jobCount = imported.size() + images.size();
+		if (importOptions.threadPool)
+			importOptions.threadPool->ParallelFor(jobCount, 1, convert);
+		else
+			convert(0, jobCount);
+	}
+
+	void buildLODIndices(ImportedMesh& mesh) const
+	{
+		if (importOptions.lodLevels <= 1)
 			return;
+
+		vector<unsigned int> mappedIndices;
+		if (mesh.mappedIndices)
+			mappedIndices.assign(mesh.mappedIndices, mesh.mappedIndices + mesh.mappedIndexCount);
+		const vector<unsigned int>& indices = mesh.mappedIndices ? mappedIndices : mesh.indices;
+		if (mesh.mappedVertices && importOptions.vertexFormat == VertexFormat::Packed)
+			mesh.lodIndices = SimplifyMeshLODs(static_cast<const PackedVertex*>(mesh.mappedVertices), mesh.mappedVertexCount, indices, importOptions.lodLevels, importOptions.lodReduction);
+		else if (mesh.mappedVertices)
+			mesh.lodIndices = SimplifyMeshLODs(static_cast<const Vertex*>(mesh.mappedVertices), mesh.mappedVertexCount, indices, importOptions.lodLevels, importOptions.lodReduction);
+		else if (importOptions.vertexFormat == VertexFormat::Packed)
+			mesh.lodIndices = SimplifyMeshLODs(mesh.packedVertices.data(), mesh.packedVertices.size(), indices, importOptions.lodLevels, importOptions.lodReduction);
+		else
+			mesh.lodIndices = SimplifyMeshLODs(mesh.vertices.data(), mesh.vertices.size(), indices, importOptions.lodLevels, importOptions.lodReduction);
+	}
+
+	// cacheDirectory/<file name>.<key>.meshcache, where the key hashes the model file and every option
+	// that changes the imported data; returns an empty string if the model file can't be read
+	string getCachePath(string const& path)
+	{
+		MappedFile source;
+		if (!source.Open(path))
+			return string();
+
+		uint64_t key = HashBytes(source.Data(), source.Size());
+		uint32_t settings[] = { MESH_CACHE_VERSION, (uint32_t)importOptions.vertexFormat, (uint32_t)importOptions.boneInfluences,
+			(uint32_t)importOptions.optimizeMeshes, (uint32_t)MAX_BONE_INFLUENCE, (uint32_t)sizeof(Vertex), (uint32_t)sizeof(PackedVertex) };
+		key = HashBytes(settings, sizeof(settings), key);
+		m_CacheKey = key;
+
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+		string fileName = path.substr(path.find_last_of("/\\") + 1);
+		return importOptions.cacheDirectory + '/' + fileName + '.' + hex + ".meshcache";
+	}
+
+	uint32_t cacheVertexStride() const
+	{
+		return importOptions.vertexFormat == VertexFormat::Packed ? (uint32_t)sizeof(PackedVertex) : (uint32_t)sizeof(Vertex);
+	}
+
+	// rebuilds the bones and queues textures and meshes from a cache file; Upload hands the vertex
+	// and index data to GL directly from the mapped file. Returns false on a miss or an invalid file.
+	bool importFromCache(const string& cachePath)
+	{
+		MappedFile& file = m_Pending->cacheFile;
+		if (!file.Open(cachePath))
+			return false;
+		// a Packed import that fell back to Full for its bone count was cached as Full
+		if (importOptions.vertexFormat == VertexFormat::Packed && file.Size() >= sizeof(MeshCacheHeader))
+		{
+			MeshCacheHeader header;
+			memcpy(&header, file.Data(), sizeof(header));
+			if (header.vertexFormat == (uint32_t)VertexFormat::Full && header.boneCount > (uint32_t)MAX_PACKED_BONES)
+				importOptions.vertexFormat = VertexFormat::Full;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
+		if (!ValidateMeshCache(file, m_CacheKey, (uint32_t)importOptions.vertexFormat, cacheVertexStride()))
+		{
+			cout << "ERROR::MESH_CACHE:: ignoring invalid cache file " << cachePath << endl;
+			file.Close();
+			return false;
+		}
+
+		MeshCacheHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+		const MeshCacheEntry* entries = reinterpret_cast<const MeshCacheEntry*>(file.Data() + sizeof(MeshCacheHeader));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// read the whole table before touching the model, so a corrupt table leaves it empty
+		MeshCacheReader reader(file.Data() + header.tableOffset, (size_t)header.tableSize);
+		vector<pair<string, glm::mat4>> bones(header.boneCount);
+		for (auto& bone : bones)
+		{
+			bone.first = reader.ReadString();
+			bone.second = reader.Read<glm::mat4>();
+		}
+		vector<vector<pair<string, string>>> meshTextures(header.meshCount);
+		for (uint32_t i = 0; i < header.meshCount; i++)
+		{
+			meshTextures[i].resize(entries[i].textureCount);
+			for (auto& texture : meshTextures[i])
+			{
+				texture.first = reader.ReadString();
+				texture.second = reader.ReadString();
+			}
+		}
+		if (!reader.ok)
+		{
+			cout << "ERROR::MESH_CACHE:: truncated table in " << cachePath << endl;
+			file.Close();
+			return false;
+		}
+
+		for (const auto& bone : bones)
+		{
+			BoneInfo boneInfo;
+			boneInfo.id = m_BoneNames.Intern(bone.first);
+			boneInfo.offset = bone.second;
+			m_BoneInfoMap[bone.first] = boneInfo;
+		}
+		m_BoneCounter = (int)bones.size();
+
+		m_Pending->meshes.resize(header.meshCount);
+		for (uint32_t i = 0; i < header.meshCount; i++)
+		{
+			ImportedMesh& mesh = m_Pending->meshes[i];
+			mesh.textures = meshTextures[i];
+			for (const auto& texture : mesh.textures)
+				queueTexture(texture.second);
+
+			const MeshCacheEntry& entry = entries[i];
+			mesh.mappedVertices = file.Data() + entry.vertexOffset;
+			mesh.mappedVertexCount = (size_t)entry.vertexCount;
+			mesh.mappedIndices = reinterpret_cast<const unsigned int*>(file.Data() + entry.indexOffset);
+			mesh.mappedIndexCount = (size_t)entry.indexCount;
+		}
+		return true;
+	}
+
+	// writes the freshly imported meshes, so this runs before Upload and off the context thread
+	void writeCache(const string& cachePath)
+	{
+		const vector<ImportedMesh>& meshes = m_Pending->meshes;
+		MeshCacheWriter writer;
+
+		MeshCacheHeader header = {};
+		memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+		header.version = MESH_CACHE_VERSION;
+		header.vertexFormat = (uint32_t)importOptions.vertexFormat;
+		header.vertexStride = cacheVertexStride();
+		header.meshCount = (uint32_t)meshes.size();
+		header.boneCount = (uint32_t)m_BoneCounter;
+		header.sourceHash = m_CacheKey;
+		writer.Write(header);
+
+		// entries are patched once the blob offsets are known
+		size_t entriesOffset = writer.data.size();
+		vector<MeshCacheEntry> entries(meshes.size());
+		writer.WriteBytes(entries.data(), entries.size() * sizeof(MeshCacheEntry));
+
+		header.tableOffset = writer.data.size();
+		for (int id = 0; id < m_BoneCounter; id++)
+		{
+			const string& name = m_BoneNames.GetName(id);
+			writer.WriteString(name);
+			writer.Write(m_BoneInfoMap[name].offset);
+		}
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			entries[i].textureCount = (uint32_t)meshes[i].textures.size();
+			for (const auto& texture : meshes[i].textures)
+			{
+				writer.WriteString(texture.first);
+				writer.WriteString(texture.second);
+			}
+		}
+		header.tableSize = writer.data.size() - header.tableOffset;
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const ImportedMesh& mesh = meshes[i];
+			entries[i].vertexOffset = writer.Align(16);
+			if (importOptions.vertexFormat == VertexFormat::Packed)
+			{
+				entries[i].vertexCount = mesh.packedVertices.size();
+				writer.WriteBytes(mesh.packedVertices.data(), mesh.packedVertices.size() * sizeof(PackedVertex));
+			}
+			else
+			{
+				entries[i].vertexCount = mesh.vertices.size();
+				writer.WriteBytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			}
+			entries[i].indexOffset = writer.Align(16);
+			entries[i].indexCount = mesh.indices.size();
+			writer.WriteBytes(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+		}
+
+		header.fileSize = writer.data.size();
+		writer.Patch(0, header);
+		for (size_t i = 0; i < entries.size(); i++)
+			writer.Patch(entriesOffset + i * sizeof(MeshCacheEntry), entries[i]);
+
+		if (!writer.Save(cachePath))
+			cout << "ERROR::MESH_CACHE:: failed to write " << cachePath << endl;
+	}
+
+	void computeBounds()
+	{
+		if (meshes.empty())
+			return;
+
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+		for (const Mesh& mesh : meshes)
+		{
+			boundsMin = glm::min(boundsMin, mesh.boundsMin);
+			boundsMax = glm::max(boundsMax, mesh.boundsMax);
+		}
+		boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		boundsRadius = 0.0f;
+		for (const Mesh& mesh : meshes)
+			boundsRadius = std::max(boundsRadius, glm::distance(boundsCenter, mesh.boundsCenter) + mesh.boundsRadius);
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene)
+	void processNode(aiNode* node, const aiScene* scene, vector<aiMesh*>& sceneMeshes)
 	{
-		// process each mesh located at the current node
+		// collect each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, sceneMeshes);
 		}
 
 	}
@@ -105,12 +644,16 @@ private:
 	}
 
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	// converts one aiMesh into out. Runs on worker threads: it must not touch GL or any model state
+	// other than reading the bone table.
+	void processMesh(aiMesh* mesh, ImportedMesh& out)
 	{
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		vector<Vertex>& vertices = out.vertices;
+		vector<unsigned int>& indices = out.indices;
+		out.name = mesh->mName.C_Str();
+		vertices.reserve(mesh->mNumVertices);
+		indices.reserve(mesh->mNumFaces * 3);
 
 		// walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -155,7 +698,11 @@ private:
 				vertex.Bitangent = vector;
 			}
 			else
+			{
 				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+			}
 
 			vertices.push_back(vertex);
 		}
@@ -167,70 +714,158 @@ private:
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
 		}
-		// process materials
-		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+
+		ExtractBoneWeightForVertices(vertices, mesh);
+
+		if (importOptions.optimizeMeshes)
+			out.stats = OptimizeMesh(vertices, indices);
+
+		if (importOptions.vertexFormat == VertexFormat::Packed)
+		{
+			out.packedVertices.reserve(vertices.size());
+			for (const Vertex& vertex : vertices)
+				out.packedVertices.push_back(PackVertex(vertex));
+			vector<Vertex>().swap(vertices);
+		}
+	}
+
+	// records the textures of a mesh's material and queues every texture not seen before for decoding
+	void collectMaterialTextures(aiMaterial* material, ImportedMesh& out)
+	{
 		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
 		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
 		// Same applies to other texture as the following list summarizes:
 		// diffuse: texture_diffuseN
 		// specular: texture_specularN
 		// normal: texture_normalN
+		const pair<aiTextureType, const char*> textureTypes[] = {
+			{ aiTextureType_DIFFUSE, "texture_diffuse" },
+			{ aiTextureType_SPECULAR, "texture_specular" },
+			{ aiTextureType_HEIGHT, "texture_normal" },
+			{ aiTextureType_AMBIENT, "texture_height" },
+		};
+		for (const auto& textureType : textureTypes)
+		{
+			for (unsigned int i = 0; i < material->GetTextureCount(textureType.first); i++)
+			{
+				aiString str;
+				material->GetTexture(textureType.first, i, &str);
+				string path = str.C_Str();
+				out.textures.push_back({ textureType.second, path });
+				queueTexture(path);
+			}
+		}
+	}
+
+	// queues a texture for decoding unless this import queued it already or another model keeps it
+	// resident in the TextureCache
+	void queueTexture(const string& path)
+	{
+		string canonicalPath = CanonicalTexturePath(directory + '/' + path);
+		if (m_TextureIds.count(canonicalPath) || m_Pending->imageIndex.count(canonicalPath) || TextureCache::Get().Contains(canonicalPath))
+			return;
 
-		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
-		ExtractBoneWeightForVertices(vertices, mesh, scene);
-
-		return Mesh(vertices, indices, textures);
+		DecodedImage image;
+		image.path = path;
+		image.directory = directory;
+		m_Pending->imageIndex.emplace(canonicalPath, m_Pending->images.size());
+		m_Pending->images.push_back(image);
 	}
 
-	void SetVertexBoneData(Vertex& vertex, int boneID, float weight)
+	// creates the GL objects for an imported mesh; context thread only
+	void uploadMesh(ImportedMesh& imported)
 	{
-		for (int i = 0; i < MAX_BONE_INFLUENCE; ++i)
+		// optimization results show up as profiler counters, one sample per mesh
+		if (importOptions.optimizeMeshes && !imported.mappedVertices)
 		{
-			if (vertex.m_BoneIDs[i] < 0)
+			PROFILE_COUNTER("Mesh ACMR before", imported.stats.acmrBefore);
+			PROFILE_COUNTER("Mesh ACMR after", imported.stats.acmrAfter);
+			PROFILE_COUNTER("Mesh vertices before", imported.stats.verticesBefore);
+			PROFILE_COUNTER("Mesh vertices after", imported.stats.verticesAfter);
+		}
+
+		vector<Texture> textures;
+		for (const auto& texture : imported.textures)
+			textures.push_back(loadTexture(texture.second, texture.first));
+
+		// SetLODs rebuilds the element buffer from the CPU indices, so those are kept until it has run
+		bool keepCPUData = !importOptions.releaseCPUData || !imported.lodIndices.empty();
+		if (imported.mappedVertices)
+			meshes.emplace_back(importOptions.vertexFormat, imported.mappedVertices, imported.mappedVertexCount, imported.mappedIndices, imported.mappedIndexCount, std::move(textures), keepCPUData);
+		else if (importOptions.vertexFormat == VertexFormat::Packed)
+			meshes.emplace_back(std::move(imported.packedVertices), std::move(imported.indices), std::move(textures));
+		else
+			meshes.emplace_back(std::move(imported.vertices), std::move(imported.indices), std::move(textures));
+
+		Mesh& mesh = meshes.back();
+		if (!imported.lodIndices.empty())
+			mesh.SetLODs(imported.lodIndices);
+		if (importOptions.releaseCPUData)
+			mesh.ReleaseCPUData();
+	}
+
+	struct BoneInfluence
+	{
+		int boneID;
+		float weight;
+	};
+
+	// keeps the maxInfluences heaviest influences (ties broken by bone id, so imports are
+	// deterministic) and renormalizes them to sum to 1
+	void SetVertexBoneData(Vertex& vertex, vector<BoneInfluence>& influences, int maxInfluences)
+	{
+		int count = std::min((int)influences.size(), maxInfluences);
+		std::partial_sort(influences.begin(), influences.begin() + count, influences.end(),
+			[](const BoneInfluence& a, const BoneInfluence& b)
 			{
-				vertex.m_Weights[i] = weight;
-				vertex.m_BoneIDs[i] = boneID;
-				break;
-			}
+				return a.weight != b.weight ? a.weight > b.weight : a.boneID < b.boneID;
+			});
+
+		float totalWeight = 0.0f;
+		for (int i = 0; i < count; ++i)
+			totalWeight += influences[i].weight;
+
+		for (int i = 0; i < count; ++i)
+		{
+			vertex.m_BoneIDs[i] = influences[i].boneID;
+			vertex.m_Weights[i] = totalWeight > 0.0f ? influences[i].weight / totalWeight : 0.0f;
 		}
 	}
 
 
-	void ExtractBoneWeightForVertices(std::vector<Vertex>& vertices, aiMesh* mesh, const aiScene* scene)
+	// assigns ids to bones seen for the first time; must run serially, in mesh order
+	void RegisterBones(aiMesh* mesh)
 	{
-		auto& boneInfoMap = m_BoneInfoMap;
-		int& boneCount = m_BoneCounter;
+		for (unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; ++boneIndex)
+		{
+			std::string boneName = mesh->mBones[boneIndex]->mName.C_Str();
+			if (m_BoneNames.Find(boneName) != BoneNameTable::InvalidHandle)
+				continue;
+
+			BoneInfo newBoneInfo;
+			newBoneInfo.id = m_BoneNames.Intern(boneName);
+			assert(newBoneInfo.id == m_BoneCounter);
+			newBoneInfo.offset = AssimpGLMHelpers::ConvertMatrixToGLMFormat(mesh->mBones[boneIndex]->mOffsetMatrix);
+			m_BoneInfoMap[boneName] = newBoneInfo;
+			m_BoneCounter++;
+		}
+	}
+
+	// only reads the bone table, so meshes can be processed concurrently once RegisterBones has run
+	void ExtractBoneWeightForVertices(std::vector<Vertex>& vertices, aiMesh* mesh)
+	{
+		if (mesh->mNumBones == 0)
+			return;
+
+		// gather every influence first: Assimp delivers them per bone, so the heaviest ones
+		// for a vertex are only known once all bones have been visited
+		vector<vector<BoneInfluence>> influences(vertices.size());
 
 		for (int boneIndex = 0; boneIndex < mesh->mNumBones; ++boneIndex)
 		{
-			int boneID = -1;
 			std::string boneName = mesh->mBones[boneIndex]->mName.C_Str();
-			if (boneInfoMap.find(boneName) == boneInfoMap.end())
-			{
-				BoneInfo newBoneInfo;
-				newBoneInfo.id = boneCount;
-				newBoneInfo.offset = AssimpGLMHelpers::ConvertMatrixToGLMFormat(mesh->mBones[boneIndex]->mOffsetMatrix);
-				boneInfoMap[boneName] = newBoneInfo;
-				boneID = boneCount;
-				boneCount++;
-			}
-			else
-			{
-				boneID = boneInfoMap[boneName].id;
-			}
-			assert(boneID != -1);
+			int boneID = m_BoneNames.Find(boneName);
+			assert(boneID != BoneNameTable::InvalidHandle);
 			auto weights = mesh->mBones[boneIndex]->mWeights;
 			int numWeights = mesh->mBones[boneIndex]->mNumWeights;
 
@@ -238,84 +873,57 @@ private:
 			{
 				int vertexId = weights[weightIndex].mVertexId;
 				float weight = weights[weightIndex].mWeight;
-				assert(vertexId <= vertices.size());
-				SetVertexBoneData(vertices[vertexId], boneID, weight);
+				assert(vertexId < vertices.size());
+				if (weight > 0.0f)
+					influences[vertexId].push_back({ boneID, weight });
 			}
 		}
+
+		for (size_t i = 0; i < vertices.size(); ++i)
+			SetVertexBoneData(vertices[i], influences[i], importOptions.boneInfluences);
 	}
 
 
 	unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false)
 	{
-		string filename = string(path);
-		filename = directory + '/' + filename;
-
-		unsigned int textureID;
-		glGenTextures(1, &textureID);
-
-		int width, height, nrComponents;
-		unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrComponents == 1)
-				format = GL_RED;
-			else if (nrComponents == 3)
-				format = GL_RGB;
-			else if (nrComponents == 4)
-				format = GL_RGBA;
-
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Texture failed to load at path: " << path << std::endl;
-			stbi_image_free(data);
-		}
-
-		return textureID;
+		DecodedImage image;
+		image.path = path;
+		image.directory = directory;
+		DecodeImage(image);
+		return UploadTexture(image);
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+	// the model's use of a texture relative to its directory. The first use takes a TextureCache
+	// reference, uploading the image decoded during Import if no other model holds the texture.
+	Texture loadTexture(const string& path, const string& typeName)
 	{
-		vector<Texture> textures;
-		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+		string canonicalPath = CanonicalTexturePath(directory + '/' + path);
+		auto iter = m_TextureIds.find(canonicalPath);
+		if (iter == m_TextureIds.end())
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
+			unsigned int id = TextureCache::Get().Acquire(canonicalPath);
+			if (id == 0)
 			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+				if (m_Pending && m_Pending->imageIndex.count(canonicalPath))
+					id = UploadTexture(m_Pending->images[m_Pending->imageIndex[canonicalPath]]);
+				else
+					id = TextureFromFile(path.c_str(), directory); // released by its last user since Import
+				id = TextureCache::Get().Insert(canonicalPath, id);
 			}
+			iter = m_TextureIds.emplace(canonicalPath, id).first;
+
+			Texture loaded;
+			loaded.id = id;
+			loaded.type = typeName;
+			loaded.path = path;
+			textures_loaded.push_back(loaded);
 		}
-		return textures;
+
+		Texture texture;
+		texture.id = iter->second;
+		texture.type = typeName;
+		texture.path = path;
+		return texture;
 	}
 };
 
@@ -0,0 +1,294 @@
+#pragma once
+
+/* Frame profiler: scoped CPU zones and GL timer query zones, written as Chrome trace JSON */
+
+// Everything below the macros is only compiled with IK_ENABLE_PROFILER defined; without it the
+// macros expand to nothing and no GL queries, clocks or files are touched.
+//
+//   PROFILE_BEGIN_SESSION("trace.json");   // after the GL context exists
+//   {
+//       PROFILE_CPU_SCOPE("Draw");         // wall time of the enclosing block
+//       PROFILE_GPU_SCOPE("Draw");         // GL_TIME_ELAPSED of the commands issued in it
+//       PROFILE_COUNTER("Instances", count);
+//   }
+//   PROFILE_FRAME_END();                   // once per frame, collects finished GPU zones
+//   PROFILE_END_SESSION();                 // before the context is destroyed
+//
+// Load the file in chrome://tracing or ui.perfetto.dev. Names must be string literals (they are
+// kept by pointer until written). CPU zones may be opened on any thread. GPU zones belong on the
+// context thread and must not overlap, since only one GL_TIME_ELAPSED query can be active; they
+// are drawn on their own "GPU" track starting at the CPU time they were issued.
+
+#ifdef IK_ENABLE_PROFILER
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Profiler
+{
+public:
+	static Profiler& Get()
+	{
+		static Profiler instance;
+		return instance;
+	}
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	void BeginSession(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_File.is_open())
+			return;
+		m_File.open(path);
+		if (!m_File)
+		{
+			std::cout << "ERROR::PROFILER:: could not open " << path << std::endl;
+			return;
+		}
+		m_Start = std::chrono::steady_clock::now();
+		m_FirstEvent = true;
+		m_Frame = 0;
+		m_File << "{\"traceEvents\":[";
+		WriteThreadName(GPU_TRACK, "GPU");
+		ThreadTrack(); // the session's thread is track 1, "Main"
+		m_Active = true;
+	}
+
+	// waits for the GPU zones still in flight, so call it while the context is current
+	void EndSession()
+	{
+		CollectGpuZones(true);
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_File.is_open())
+			return;
+		m_Active = false;
+		m_File << "]}\n";
+		m_File.close();
+		if (!m_Queries.empty())
+			glDeleteQueries((GLsizei)m_Queries.size(), m_Queries.data());
+		m_Queries.clear();
+		m_FreeQueries.clear();
+		m_ThreadIds.clear();
+	}
+
+	bool IsActive() const { return m_Active; }
+
+	// microseconds since BeginSession
+	double Now() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_Start).count();
+	}
+
+	void WriteCpuZone(const char* name, double start, double end)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Active)
+			return;
+		WriteZone(name, "cpu", start, end - start, ThreadTrack());
+	}
+
+	void Counter(const char* name, double value)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Active)
+			return;
+		BeginEvent();
+		m_File << "{\"name\":\"" << name << "\",\"ph\":\"C\",\"ts\":" << Now() << ",\"pid\":0,\"args\":{\"value\":" << value << "}}";
+	}
+
+	void BeginGpuZone(const char* name)
+	{
+		if (!m_Active)
+			return;
+		assert(!m_GpuZoneOpen && "GL_TIME_ELAPSED zones cannot nest");
+		GpuZone zone;
+		zone.name = name;
+		zone.start = Now();
+		zone.query = AcquireQuery();
+		glBeginQuery(GL_TIME_ELAPSED, zone.query);
+		m_GpuZones.push_back(zone);
+		m_GpuZoneOpen = true;
+	}
+
+	void EndGpuZone()
+	{
+		if (!m_GpuZoneOpen)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		m_GpuZoneOpen = false;
+	}
+
+	// writes the GPU zones whose results have arrived; older frames finish first, so the
+	// search stops at the first zone that isn't ready
+	void EndFrame()
+	{
+		if (!m_Active)
+			return;
+		CollectGpuZones(false);
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Frame++;
+		m_File.flush();
+	}
+
+private:
+	struct GpuZone
+	{
+		const char* name;
+		double start;
+		GLuint query;
+	};
+
+	static const int GPU_TRACK = 0;
+
+	Profiler() {}
+
+	void CollectGpuZones(bool wait)
+	{
+		while (!m_GpuZones.empty())
+		{
+			const GpuZone& zone = m_GpuZones.front();
+			if (m_GpuZoneOpen && m_GpuZones.size() == 1)
+				break; // still recording
+			GLint available = 0;
+			if (!wait)
+			{
+				glGetQueryObjectiv(zone.query, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					break;
+			}
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(zone.query, GL_QUERY_RESULT, &elapsed);
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				if (m_Active)
+					WriteZone(zone.name, "gpu", zone.start, elapsed / 1000.0, GPU_TRACK);
+			}
+			m_FreeQueries.push_back(zone.query);
+			m_GpuZones.pop_front();
+		}
+	}
+
+	GLuint AcquireQuery()
+	{
+		if (m_FreeQueries.empty())
+		{
+			GLuint query = 0;
+			glGenQueries(1, &query);
+			m_Queries.push_back(query);
+			return query;
+		}
+		GLuint query = m_FreeQueries.back();
+		m_FreeQueries.pop_back();
+		return query;
+	}
+
+	// trace track of the calling thread, 1.. in order of first use; m_Mutex must be held
+	int ThreadTrack()
+	{
+		auto inserted = m_ThreadIds.emplace(std::this_thread::get_id(), (int)m_ThreadIds.size() + 1);
+		if (inserted.second)
+			WriteThreadName(inserted.first->second, inserted.first->second == 1 ? "Main" : "Worker");
+		return inserted.first->second;
+	}
+
+	void BeginEvent()
+	{
+		if (!m_FirstEvent)
+			m_File << ",";
+		m_File << "\n";
+		m_FirstEvent = false;
+	}
+
+	void WriteZone(const char* name, const char* category, double start, double duration, int track)
+	{
+		BeginEvent();
+		m_File << "{\"name\":\"" << name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << duration
+			<< ",\"pid\":0,\"tid\":" << track << ",\"args\":{\"frame\":" << m_Frame << "}}";
+	}
+
+	void WriteThreadName(int track, const char* name)
+	{
+		BeginEvent();
+		m_File << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << track << ",\"args\":{\"name\":\"" << name << "\"}}";
+	}
+
+	std::mutex m_Mutex; // guards the file and the thread table; GPU zone state is context-thread only
+	std::ofstream m_File;
+	std::atomic<bool> m_Active{ false }; // read without the lock by the scopes
+	bool m_FirstEvent = true;
+	uint64_t m_Frame = 0;
+	std::chrono::steady_clock::time_point m_Start;
+	std::unordered_map<std::thread::id, int> m_ThreadIds;
+
+	std::deque<GpuZone> m_GpuZones; // issued, oldest first
+	std::vector<GLuint> m_Queries;  // every query object created, for deletion
+	std::vector<GLuint> m_FreeQueries;
+	bool m_GpuZoneOpen = false;
+};
+
+class CpuProfileScope
+{
+public:
+	explicit CpuProfileScope(const char* name)
+		: m_Name(name), m_Start(Profiler::Get().IsActive() ? Profiler::Get().Now() : 0.0)
+	{
+	}
+
+	~CpuProfileScope()
+	{
+		if (Profiler::Get().IsActive())
+			Profiler::Get().WriteCpuZone(m_Name, m_Start, Profiler::Get().Now());
+	}
+
+	CpuProfileScope(const CpuProfileScope&) = delete;
+	CpuProfileScope& operator=(const CpuProfileScope&) = delete;
+
+private:
+	const char* m_Name;
+	double m_Start;
+};
+
+class GpuProfileScope
+{
+public:
+	explicit GpuProfileScope(const char* name) { Profiler::Get().BeginGpuZone(name); }
+	~GpuProfileScope() { Profiler::Get().EndGpuZone(); }
+
+	GpuProfileScope(const GpuProfileScope&) = delete;
+	GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#define PROFILE_BEGIN_SESSION(path) Profiler::Get().BeginSession(path)
+#define PROFILE_END_SESSION() Profiler::Get().EndSession()
+#define PROFILE_CPU_SCOPE(name) CpuProfileScope PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::Get().Counter(name, (double)(value))
+#define PROFILE_FRAME_END() Profiler::Get().EndFrame()
+
+#else
+
+#define PROFILE_BEGIN_SESSION(path) ((void)0)
+#define PROFILE_END_SESSION() ((void)0)
+#define PROFILE_CPU_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_FRAME_END() ((void)0)
+
+#endif
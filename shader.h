@@ -8,14 +8,27 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// uniform location resolved once, typed with the value it is set with; get it from
+// Shader::getUniform after construction, keep it and pass it to Shader::set every frame
+template <typename T>
+struct UniformHandle
+{
+    GLint location = -1;
+    bool isValid() const { return location >= 0; }
+};
 
 class Shader
 {
 public:
     unsigned int ID;
     // constructor generates the shader on the fly
+    // defines are inserted as "#define <define>" lines after the #version directive of every
+    // stage, which is how compile-time variants (e.g. "MAX_BONE_INFLUENCE 8") are built
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::vector<std::string>& defines = {})
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -41,8 +54,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            vertexCode = injectDefines(vShaderStream.str(), defines);
+            fragmentCode = injectDefines(fShaderStream.str(), defines);
             // if geometry shader path is present, also load a geometry shader
             if (geometryPath != nullptr)
             {
@@ -50,7 +63,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = injectDefines(gShaderStream.str(), defines);
             }
         }
         catch (std::ifstream::failure& e)
@@ -89,6 +102,7 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        reflectUniforms();
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -102,66 +116,164 @@ public:
     {
         glUseProgram(ID);
     }
+    // location of an active uniform from the table built after linking, -1 (ignored by the
+    // glUniform* calls) if there is none. Arrays are found both as "name" and "name[i]".
+    // ------------------------------------------------------------------------
+    GLint getUniformLocation(const std::string& name) const
+    {
+        auto location = uniformLocations.find(name);
+        return location != uniformLocations.end() ? location->second : -1;
+    }
+    template <typename T>
+    UniformHandle<T> getUniform(const std::string& name) const
+    {
+        UniformHandle<T> handle;
+        handle.location = getUniformLocation(name);
+        return handle;
+    }
+    // attaches the program's uniform block blockName to a binding point (see uniform_buffer.h);
+    // false if the program has no such block
+    // ------------------------------------------------------------------------
+    bool bindUniformBlock(const std::string& blockName, unsigned int binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, blockName.c_str());
+        if (index == GL_INVALID_INDEX)
+            return false;
+        glUniformBlockBinding(ID, index, binding);
+        return true;
+    }
+    // uniform functions for stored handles, no lookup at all
+    // ------------------------------------------------------------------------
+    void set(UniformHandle<bool> uniform, bool value) const { glUniform1i(uniform.location, (int)value); }
+    void set(UniformHandle<int> uniform, int value) const { glUniform1i(uniform.location, value); }
+    void set(UniformHandle<float> uniform, float value) const { glUniform1f(uniform.location, value); }
+    void set(UniformHandle<glm::vec2> uniform, const glm::vec2& value) const { glUniform2fv(uniform.location, 1, &value[0]); }
+    void set(UniformHandle<glm::vec3> uniform, const glm::vec3& value) const { glUniform3fv(uniform.location, 1, &value[0]); }
+    void set(UniformHandle<glm::vec4> uniform, const glm::vec4& value) const { glUniform4fv(uniform.location, 1, &value[0]); }
+    void set(UniformHandle<glm::mat2> uniform, const glm::mat2& mat) const { glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    void set(UniformHandle<glm::mat3> uniform, const glm::mat3& mat) const { glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    void set(UniformHandle<glm::mat4> uniform, const glm::mat4& mat) const { glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    // count consecutive elements of a mat4 array, starting at the handle's element (e.g. a bone palette)
+    void set(UniformHandle<glm::mat4> uniform, const glm::mat4* mats, int count) const { glUniformMatrix4fv(uniform.location, count, GL_FALSE, &mats[0][0][0]); }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(getUniformLocation(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(getUniformLocation(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(getUniformLocation(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(getUniformLocation(name), 1, &value[0]);
     }
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(getUniformLocation(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(getUniformLocation(name), 1, &value[0]);
     }
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(getUniformLocation(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(getUniformLocation(name), 1, &value[0]);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(getUniformLocation(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    // utility function for filling uniformLocations once the program is linked. Arrays are
+    // reported once as "name[0]", so the base name and every element are added as well.
+    // Uniform block members have no location and are skipped.
+    // ------------------------------------------------------------------------
+    void reflectUniforms()
+    {
+        uniformLocations.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location < 0)
+                continue;
+            uniformLocations[name] = location;
+
+            if (name.size() < 3 || name.compare(name.size() - 3, 3, "[0]") != 0)
+                continue;
+            std::string base = name.substr(0, name.size() - 3);
+            uniformLocations[base] = location;
+            for (GLint element = 1; element < size; element++)
+            {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                GLint elementLocation = glGetUniformLocation(ID, elementName.c_str());
+                if (elementLocation >= 0)
+                    uniformLocations[elementName] = elementLocation;
+            }
+        }
+    }
+
+    // utility function for inserting preprocessor defines right after the #version line.
+    // ------------------------------------------------------------------------
+    static std::string injectDefines(const std::string& source, const std::vector<std::string>& defines)
+    {
+        if (defines.empty())
+            return source;
+
+        std::string block;
+        for (const std::string& define : defines)
+            block += "#define " + define + "\n";
+
+        size_t version = source.find("#version");
+        if (version == std::string::npos)
+            return block + source;
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return source + "\n" + block;
+        return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
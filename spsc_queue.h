@@ -0,0 +1,68 @@
+#pragma once
+
+/* Lock-free single-producer single-consumer ring buffer */
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed-capacity FIFO for one producer thread and one consumer thread, for example window
+// callbacks feeding the simulation. Each side only writes its own index and reads the other's, so
+// Push and Pop never block and never allocate. Capacity must be a power of two; one slot stays
+// empty to tell a full ring from an empty one.
+template <typename T, size_t Capacity>
+class SPSCQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+public:
+	SPSCQueue() = default;
+	SPSCQueue(const SPSCQueue&) = delete;
+	SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+	// producer side: false if the queue is full, in which case the item is dropped
+	bool Push(const T& item)
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) & MASK;
+		if (next == m_Head.load(std::memory_order_acquire))
+			return false;
+		m_Items[tail] = item;
+		m_Tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side: the oldest item without removing it, nullptr if the queue is empty
+	const T* Front() const
+	{
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		if (head == m_Tail.load(std::memory_order_acquire))
+			return nullptr;
+		return &m_Items[head];
+	}
+
+	// consumer side: removes the item returned by Front
+	void PopFront()
+	{
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		m_Head.store((head + 1) & MASK, std::memory_order_release);
+	}
+
+	// consumer side: moves the oldest item into item; false if the queue is empty
+	bool Pop(T& item)
+	{
+		const T* front = Front();
+		if (!front)
+			return false;
+		item = *front;
+		PopFront();
+		return true;
+	}
+
+private:
+	static const size_t MASK = Capacity - 1;
+
+	T m_Items[Capacity];
+	// on separate cache lines so the two threads don't invalidate each other's index
+	alignas(64) std::atomic<size_t> m_Head{ 0 }; // next item to read, written by the consumer
+	alignas(64) std::atomic<size_t> m_Tail{ 0 }; // next slot to write, written by the producer
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+/* Process-wide, reference-counted cache of GL textures shared by all models */
+
+#include <glad/glad.h>
+
+#include <cassert>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// lexically normalized path: '\' becomes '/', "." and empty segments are dropped and ".." removes
+// the segment before it. Symlinks are not resolved, so two links to one file stay two entries.
+inline std::string CanonicalTexturePath(const std::string& path)
+{
+	bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+	std::vector<std::string> segments;
+	size_t begin = 0;
+	while (begin <= path.size())
+	{
+		size_t end = path.find_first_of("/\\", begin);
+		if (end == std::string::npos)
+			end = path.size();
+		std::string segment = path.substr(begin, end - begin);
+		if (segment == "..")
+		{
+			if (!segments.empty() && segments.back() != "..")
+				segments.pop_back();
+			else if (!absolute)
+				segments.push_back(segment);
+		}
+		else if (!segment.empty() && segment != ".")
+		{
+			segments.push_back(segment);
+		}
+		begin = end + 1;
+	}
+
+	std::string canonical = absolute ? "/" : "";
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		if (i > 0)
+			canonical += '/';
+		canonical += segments[i];
+	}
+	return canonical;
+}
+
+// Entries are keyed by canonical path (see CanonicalTexturePath). Acquire, Contains and Size may be
+// called from any thread; Insert and Release create and delete GL textures and belong on the
+// context thread.
+class TextureCache
+{
+public:
+	static TextureCache& Get()
+	{
+		static TextureCache instance;
+		return instance;
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// id of the cached texture with one more reference taken, or 0 if it isn't resident
+	unsigned int Acquire(const std::string& canonicalPath)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		Entry* entry = Find(canonicalPath);
+		if (!entry)
+			return 0;
+		entry->references++;
+		return entry->id;
+	}
+
+	// adds a freshly uploaded texture with one reference and returns the id to use. If the path
+	// was inserted in the meantime, that texture gets the reference and id is deleted.
+	unsigned int Insert(const std::string& canonicalPath, unsigned int id)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (Entry* entry = Find(canonicalPath))
+		{
+			glDeleteTextures(1, &id);
+			entry->references++;
+			return entry->id;
+		}
+
+		m_Entries.emplace(canonicalPath, Entry{ id, 1 });
+		return id;
+	}
+
+	// drops one reference; the texture is deleted with the last one
+	void Release(const std::string& canonicalPath)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto iter = m_Entries.find(canonicalPath);
+		if (iter == m_Entries.end())
+			return;
+
+		assert(iter->second.references > 0);
+		if (--iter->second.references == 0)
+		{
+			glDeleteTextures(1, &iter->second.id);
+			m_Entries.erase(iter);
+		}
+	}
+
+	bool Contains(const std::string& canonicalPath)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return Find(canonicalPath) != nullptr;
+	}
+
+	size_t Size()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Entries.size();
+	}
+
+private:
+	struct Entry
+	{
+		unsigned int id;
+		int references;
+	};
+
+	TextureCache() {}
+
+	Entry* Find(const std::string& canonicalPath)
+	{
+		auto iter = m_Entries.find(canonicalPath);
+		return iter != m_Entries.end() ? &iter->second : nullptr;
+	}
+
+	std::mutex m_Mutex;
+	std::unordered_map<std::string, Entry> m_Entries;
+};
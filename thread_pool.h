@@ -0,0 +1,129 @@
+#pragma once
+
+/* Fixed-size pool of worker threads */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency())
+	{
+		if (threadCount == 0)
+			threadCount = 1;
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			m_Workers.emplace_back([this] { WorkerLoop(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+		m_Condition.notify_all();
+
+		for (auto& worker : m_Workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Jobs.push(std::move(job));
+		}
+		m_Condition.notify_one();
+	}
+
+	// runs fn(begin, end) over [0, count) in chunks of at most grainSize and blocks until
+	// every chunk is done. The calling thread takes chunks as well, so this never deadlocks
+	// when all workers are busy.
+	void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& fn)
+	{
+		if (count == 0)
+			return;
+
+		grainSize = std::max<size_t>(grainSize, 1);
+		size_t chunkCount = (count + grainSize - 1) / grainSize;
+		if (chunkCount == 1)
+		{
+			fn(0, count);
+			return;
+		}
+
+		struct ForState
+		{
+			std::atomic<size_t> nextChunk{ 0 };
+			std::atomic<size_t> doneChunks{ 0 };
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		auto state = std::make_shared<ForState>();
+
+		// fn is only touched while chunks remain, i.e. before this call returns
+		auto runChunks = [state, chunkCount, grainSize, count, &fn]()
+		{
+			size_t chunk;
+			while ((chunk = state->nextChunk.fetch_add(1)) < chunkCount)
+			{
+				size_t begin = chunk * grainSize;
+				size_t end = std::min(begin + grainSize, count);
+				fn(begin, end);
+
+				if (state->doneChunks.fetch_add(1) + 1 == chunkCount)
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->finished.notify_all();
+				}
+			}
+		};
+
+		size_t helpers = std::min(m_Workers.size(), chunkCount - 1);
+		for (size_t i = 0; i < helpers; i++)
+			Submit(runChunks);
+
+		runChunks();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&] { return state->doneChunks.load() == chunkCount; });
+	}
+
+	size_t GetThreadCount() const { return m_Workers.size(); }
+
+private:
+	void WorkerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Condition.wait(lock, [this] { return m_Stopping || !m_Jobs.empty(); });
+				if (m_Stopping && m_Jobs.empty())
+					return;
+				job = std::move(m_Jobs.front());
+				m_Jobs.pop();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread> m_Workers;
+	std::queue<std::function<void()>> m_Jobs;
+	std::mutex m_Mutex;
+	std::condition_variable m_Condition;
+	bool m_Stopping = false;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+/* Lock-free single-producer single-consumer triple buffer */
+
+#include <atomic>
+#include <cstdint>
+
+// Three slots: the writer fills one, the reader holds one and the third is parked in between.
+// Publish swaps the writer's slot with the parked one and Acquire swaps the reader's slot with
+// it, each with a single atomic exchange, so neither side ever waits for the other. The reader
+// always gets the newest complete T; slots the reader never picked up are simply overwritten.
+//
+// Slots are reused, not reset: a T holding vectors keeps their capacity, so steady-state
+// publishing doesn't allocate. The writer must rewrite every field it relies on.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// writer side: the slot to fill, private to the writer until Publish
+	T& WriteBuffer() { return m_Slots[m_WriteIndex]; }
+
+	// writer side: makes the written slot the newest one and hands the writer a free slot
+	void Publish()
+	{
+		uint8_t previous = m_Parked.exchange((uint8_t)(m_WriteIndex | FRESH_BIT), std::memory_order_acq_rel);
+		m_WriteIndex = previous & INDEX_MASK;
+	}
+
+	// reader side: switches to the newest published slot if there is one; false if nothing was
+	// published since the last call, in which case ReadBuffer still holds the previous packet
+	bool Acquire()
+	{
+		if (!(m_Parked.load(std::memory_order_relaxed) & FRESH_BIT))
+			return false;
+		uint8_t previous = m_Parked.exchange(m_ReadIndex, std::memory_order_acq_rel);
+		m_ReadIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	// reader side: the slot taken by the last successful Acquire (a default T before that)
+	const T& ReadBuffer() const { return m_Slots[m_ReadIndex]; }
+
+	// calls f on all three slots, e.g. to size them up front; neither side may use the buffer meanwhile
+	template <typename F>
+	void ForEachSlot(F f)
+	{
+		for (T& slot : m_Slots)
+			f(slot);
+	}
+
+private:
+	static const uint8_t INDEX_MASK = 0x3;
+	static const uint8_t FRESH_BIT = 0x4; // the parked slot holds data the reader hasn't seen
+
+	T m_Slots[3];
+	uint8_t m_WriteIndex = 0;           // writer thread only
+	uint8_t m_ReadIndex = 1;            // reader thread only
+	std::atomic<uint8_t> m_Parked{ 2 }; // index of the slot in between, plus FRESH_BIT
+};
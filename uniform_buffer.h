@@ -0,0 +1,89 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+// Per-frame state shared by every program through std140 uniform blocks. Each block has a fixed
+// binding point; a program attaches its block with Shader::bindUniformBlock once after
+// construction, and one buffer update is then seen by all programs.
+//
+//   layout (std140) uniform Camera { mat4 projection; mat4 view; vec4 viewPos; };
+//   layout (std140) uniform Light  { vec4 direction; vec4 color; vec4 ambient; vec4 diffuse; vec4 specular; } dirLight;
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+const unsigned int LIGHT_BLOCK_BINDING = 1;
+
+// std140 pads a vec3 to 16 bytes, so the C++ side uses vec4 and ignores w
+struct CameraBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec4 viewPos;
+};
+
+struct LightBlock {
+    glm::vec4 direction;
+    glm::vec4 color;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout");
+static_assert(sizeof(LightBlock) == 80, "LightBlock must match the std140 layout");
+
+// GL buffer holding one block, bound to its binding point for its whole lifetime
+template <typename T>
+class UniformBuffer {
+public:
+    explicit UniformBuffer(unsigned int binding)
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    ~UniformBuffer()
+    {
+        release();
+    }
+
+    // uploads data unless the buffer already holds exactly that; returns whether it uploaded,
+    // i.e. whether the block changed since the last call
+    bool update(const T& data)
+    {
+        if (uploaded && std::memcmp(&data, &current, sizeof(T)) == 0)
+            return false;
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        current = data;
+        uploaded = true;
+        return true;
+    }
+
+    const T& data() const { return current; }
+
+    // deletes the buffer; call it while the context is still current if the buffer outlives it
+    void release()
+    {
+        if (ID)
+            glDeleteBuffers(1, &ID);
+        ID = 0;
+        uploaded = false;
+    }
+
+private:
+    unsigned int ID = 0;
+    T current;
+    bool uploaded = false;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef VERTEX_PACKING_H
+#define VERTEX_PACKING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cassert>
+#include <cmath>
+
+#include "mesh.h"
+
+// Conversion from Vertex to PackedVertex. The vertex shaders decode it when compiled with
+// "PACKED_VERTEX" (LoadSkinningShader adds it for VertexFormat::Packed): octDecode of the
+// location 1 normal and the location 3 tangent, bitangent = cross(normal, tangent) * tangent.w.
+
+// bone ids are stored in one byte, so a model with more bones than this can't use the packed
+// format; Model::Import falls back to VertexFormat::Full for it
+const int MAX_PACKED_BONES = 256;
+
+// maps a unit vector onto the [-1, 1]^2 square (octahedral projection)
+inline glm::vec2 OctEncode(glm::vec3 n)
+{
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum <= 0.0f)
+        return glm::vec2(0.0f);
+    n /= sum;
+
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        glm::vec2 signs(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = (glm::vec2(1.0f) - glm::abs(glm::vec2(n.y, n.x))) * signs;
+    }
+    return e;
+}
+
+inline glm::vec3 OctDecode(glm::vec2 e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if (n.z < 0.0f)
+    {
+        glm::vec2 signs(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        glm::vec2 xy = (glm::vec2(1.0f) - glm::abs(glm::vec2(n.y, n.x))) * signs;
+        n.x = xy.x;
+        n.y = xy.y;
+    }
+    return glm::normalize(n);
+}
+
+inline PackedVertex PackVertex(const Vertex& vertex)
+{
+    PackedVertex packed;
+    packed.Position = vertex.Position;
+    packed.Normal = glm::packSnorm2x16(OctEncode(vertex.Normal));
+    packed.TexCoords = glm::packHalf2x16(vertex.TexCoords);
+
+    // handedness of the tangent frame, so the bitangent can be rebuilt from normal and tangent
+    float bitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+    packed.Tangent = glm::packSnorm3x10_1x2(glm::vec4(OctEncode(vertex.Tangent), 0.0f, bitangentSign));
+
+    // quantize the weights so they still sum to exactly 255; the rounding error goes to the largest one
+    float totalWeight = 0.0f;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+    {
+        if (vertex.m_BoneIDs[i] >= 0)
+            totalWeight += vertex.m_Weights[i];
+    }
+
+    int quantizedTotal = 0;
+    int largest = 0;
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+    {
+        int id = vertex.m_BoneIDs[i];
+        assert(id < MAX_PACKED_BONES);
+        int weight = 0;
+        if (id >= 0 && totalWeight > 0.0f)
+            weight = (int)std::lround(glm::clamp(vertex.m_Weights[i] / totalWeight, 0.0f, 1.0f) * 255.0f);
+
+        packed.m_BoneIDs[i] = (uint8_t)(id >= 0 ? id : 0);
+        packed.m_Weights[i] = (uint8_t)weight;
+        quantizedTotal += weight;
+        if (weight > packed.m_Weights[largest])
+            largest = i;
+    }
+    if (quantizedTotal > 0)
+        packed.m_Weights[largest] = (uint8_t)glm::clamp(packed.m_Weights[largest] + 255 - quantizedTotal, 0, 255);
+
+    return packed;
+}
+
+#endif